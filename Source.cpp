@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#define GL_GLEXT_PROTOTYPES // buffer objects for the display
 #include <GL/freeglut.h>
 #include <FreeImage.h>
 #include <stdio.h>
@@ -7,6 +8,24 @@
 #include <iostream>
 #include <cstring>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glob.h>
+#include <atomic>
+#include <complex>
+#include <algorithm>
+
+#ifdef WITH_LIBTIFF
+#include <tiffio.h> // scanline I/O for --stream
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD // runtime dispatched SSE/AVX paths are available
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
@@ -30,679 +49,6233 @@ typedef struct {
 typedef struct {
 	Pixel *data; // collection of pixels
 	int width, height; // dimensions
+	FIBITMAP *bitmap; // non-NULL when data aliases this FreeImage buffer
+	void *mapping; // non-NULL when data lies in this mmap of a cache file
+	size_t mapped; // length of that mapping
 } Image;
 
 // some function declarations
-int checkCloser(int col[3], int rgbVals[9][3]);
 void changeConvolution(Image &img, char type);
 Image copyImage(Image);
+void fitView();
+void queueFilter(char key);
+void cancelFilters();
+void choosePreviewLevel();
 
 // global work and save buffers (easier than local scope)
 Image workBuffer, saveBuffer;
 
+// number of threads filters may use, 0 for one per core (--threads)
+int threadCount = 0;
+
 /**
-* Image Loader function
-* loads an input image into memory
-*
-* @param name - the filename of the loaded file
-* @return - image save buffer
-*/
-Image imageLoader(char *name) {
-	FIBITMAP *inputImage; // container for input image
-	inputImage = FreeImage_Load(FIF_TIFF, name, 0); //attempts to load
-	Image outputImage; // for returning later
-	// set up image dimensions
-	outputImage.width = FreeImage_GetWidth(inputImage);
-	outputImage.height = FreeImage_GetHeight(inputImage);
-	RGBQUAD pixelData; // container for image pixel data
-	Pixel *data; // blank pixel structure
-	 // ensure correct size
-	data = (Pixel*)malloc((outputImage.height)*(outputImage.width) * sizeof(Pixel));
-	int k = 0; // for iterating in a moment
-	for (int i = 0; i < outputImage.height; i++) {
-		for (int j = 0; j < outputImage.width; j++, k++) {
-			// mutate pixelData to contain RGB values of given pixel
-			FreeImage_GetPixelColor(inputImage, j, i, &pixelData);
-			// initialize color channels of pixel to match
-			data[k].red = pixelData.rgbRed;
-			data[k].green = pixelData.rgbGreen;
-			data[k].blue = pixelData.rgbBlue;
-		}
+ * Parallel executor state
+ * a persistent set of worker threads that parallelRows() hands
+ * row bands to. Workers claim bands from a shared counter so
+ * uneven bands balance themselves out. Plain pthread objects are
+ * used as they have no destructors to trip over parked workers
+ * at exit
+ */
+typedef void(*BandFn)(void *ctx, int begin, int end);
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t poolJobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolDone = PTHREAD_COND_INITIALIZER;
+static int poolThreads = 0; // workers started so far
+static int poolIds = 0; // numbers the workers as they start
+static int poolUsing = 0; // workers taking part in the current job
+static BandFn poolFn = NULL; // the current job
+static void *poolCtx = NULL;
+static int poolRows = 0, poolBand = 0; // job size and band height
+static std::atomic<int> poolNext(0); // next unclaimed row
+static int poolActive = 0; // workers still inside the current job
+static unsigned poolGeneration = 0; // bumped for every new job
+static thread_local bool poolInsideBand = false; // no nested jobs
+long long serialPixels = 1 << 15; // jobs of fewer pixels run serially, --verify lowers it to thread everything
+
+/**
+ * Claim Bands function
+ * runs bands of the current job until none are left
+ */
+void claimBands(BandFn fn, void *ctx, int rows, int band) {
+	poolInsideBand = true;
+	for (int begin = poolNext.fetch_add(band); begin < rows; begin = poolNext.fetch_add(band)) {
+		fn(ctx, begin, min(rows, begin + band));
 	}
-	FreeImage_Unload(inputImage); // no longer needed in memory
-	outputImage.data = data; // initialize image pixels
-	return outputImage; // to instantiate image in main driver
+	poolInsideBand = false;
 }
 
 /**
-* Save Image function
-* effectively the load image function in reverse
-*
-* @param name - filename to save as
-* @param i - the image to save
-*/
-void saveImage(char *name, Image img) {
-	FIBITMAP *outputImage; // output image container
-	// allocate memory to output image container
-	outputImage = FreeImage_Allocate(img.width, img.height, 24, 0, 0, 0);
-	/**
-	 * refer to load image function to get the gist
-	 * as this is just the same code more or less
-	 */
-	RGBQUAD pixelData;
-	int k = 0;
-	for (int i = 0; i < img.height; i++) {
-		for (int j = 0; j < img.width; j++, k++) {
-			pixelData.rgbRed = img.data[k].red;
-			pixelData.rgbGreen = img.data[k].green;
-			pixelData.rgbBlue = img.data[k].blue;
-			FreeImage_SetPixelColor(outputImage, j, i, &pixelData);
+ * Worker Thread function
+ * sleeps until a job is posted, helps finish it, repeats
+ */
+void *workerThread(void *generation) {
+	unsigned seen = (unsigned)(size_t)generation; // the last job before starting
+	pthread_mutex_lock(&poolLock);
+	int id = poolIds++;
+	for (;;) {
+		while (poolGeneration == seen) {
+			pthread_cond_wait(&poolWake, &poolLock);
+		}
+		seen = poolGeneration;
+		BandFn fn = poolFn;
+		void *ctx = poolCtx;
+		int rows = poolRows, band = poolBand;
+		bool helping = id < poolUsing; // --threads may have dropped since
+		pthread_mutex_unlock(&poolLock);
+		if (helping) { claimBands(fn, ctx, rows, band); }
+		pthread_mutex_lock(&poolLock);
+		if (--poolActive == 0) {
+			pthread_cond_signal(&poolDone);
 		}
 	}
-	FreeImage_Save(FIF_TIFF, outputImage, name, 0);
-	FreeImage_Unload(outputImage);
+	return NULL;
 }
 
 /**
- * Greyscale Filter function
- * applies one of two GS filters to image
- *
- * @param img - the image to work with
- * @param type - the type of GS algorithm to use
+ * Thread Total function
+ * @return - how many threads, caller included, run a job
  */
-void changeGrey(Image &img, char type) {
-	int k = 0;
-	int lum = 0; // luminance
-	double rMult, gMult, bMult; // multipliers
-	if (type == 'N') { // NTSC greyscale
-		rMult = 0.30;
-		gMult = 0.59;
-		bMult = 0.11;
-	}
-	else { // regular greyscale
-		rMult = 0.33;
-		gMult = 0.33;
-		bMult = 0.33;
-	}
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++, lum = 0) {
-			lum += img.data[k].red*rMult; // add to luminance
-			lum += img.data[k].green*gMult;
-			lum += img.data[k].blue*bMult;
-			img.data[k].red = lum; // apply
-			img.data[k].green = lum;
-			img.data[k].blue = lum;
-		}
+int threadTotal() {
+	if (threadCount > 0) {
+		return threadCount;
 	}
+	return max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
 }
 
 /**
- * Monochrome Filter function
- * changes image to B+W
+ * Run Bands function
+ * splits rows [0, rows) into bands and runs fn on all of them,
+ * spread over the worker threads and the calling thread. Small
+ * jobs, nested calls and calls made while another thread owns
+ * the pool just run serially on the caller
  *
- * @param img - the image to binarize
+ * @param rows - the number of rows
+ * @param width - pixels per row, to judge whether threads pay off
+ * @param fn - called as fn(ctx, begin, end) per band
+ * @param ctx - passed through to fn
  */
-void changeMonochrome(Image &img) {
-	int k = 0;
-	int lum = 0;
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++, lum = 0) {
-			lum += img.data[k].red*0.33;
-			lum += img.data[k].green*0.33;
-			lum += img.data[k].blue*0.33;
-			/** if higher than half, set to black
-			 * if lower, set to white, etc
-			 */
-			img.data[k].red = (lum > 128) ? 255 : 0;
-			img.data[k].green = (lum > 128) ? 255 : 0;
-			img.data[k].blue = (lum > 128) ? 255 : 0;
+void runBands(int rows, int width, BandFn fn, void *ctx) {
+	int threads = threadTotal();
+	if (threads == 1 || rows < 2 || (long long)rows*width < serialPixels || poolInsideBand
+		|| pthread_mutex_trylock(&poolJobLock) != 0) {
+		fn(ctx, 0, rows);
+		return;
+	}
+	pthread_mutex_lock(&poolLock);
+	while (poolThreads < threads - 1) { // started on first use
+		pthread_t worker;
+		if (pthread_create(&worker, NULL, workerThread, (void*)(size_t)poolGeneration) != 0) {
+			break; // make do with the workers we have
 		}
+		pthread_detach(worker);
+		poolThreads++;
 	}
+	poolFn = fn;
+	poolCtx = ctx;
+	poolRows = rows;
+	// a few bands per thread so a slow band doesn't hold the rest up
+	poolBand = max(1, rows / (threads * 4));
+	poolNext = 0;
+	poolUsing = threads - 1;
+	poolActive = poolThreads;
+	poolGeneration++;
+	pthread_cond_broadcast(&poolWake);
+	pthread_mutex_unlock(&poolLock);
+	claimBands(fn, ctx, rows, poolBand);
+	pthread_mutex_lock(&poolLock);
+	while (poolActive > 0) {
+		pthread_cond_wait(&poolDone, &poolLock);
+	}
+	pthread_mutex_unlock(&poolLock);
+	pthread_mutex_unlock(&poolJobLock);
 }
 
 /**
- * Channel Swap Filter function
- * swaps R->G, G->B, B->R
+ * Parallel Rows function
+ * runs body(begin, end) over bands of rows [0, rows) in parallel
  *
- * @param img - the image to work with
+ * @param rows - the number of rows
+ * @param width - pixels per row
+ * @param body - callable taking a band's first and one-past-last row
  */
-void changeSwap(Image &img) {
-	int k = 0;
-	int temp = 0;
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			// self explanatory
-			temp = img.data[k].red;
-			img.data[k].red = img.data[k].green;
-			img.data[k].green = img.data[k].blue;
-			img.data[k].blue = temp;
-		}
-	}
+template <typename F>
+void parallelRows(int rows, int width, F body) {
+	runBands(rows, width, [](void *ctx, int begin, int end) { (*(F*)ctx)(begin, end); }, &body);
 }
 
 /**
- * Single Channel Filter function
- * changes image color channels to singular
+ * Pointwise filters work on spans of pixels with no neighbours,
+ * which lets the executor hand out bands of rows with no halo
+ */
+typedef void(*SpanFn)(Pixel *p, int n, char type);
+
+/**
+ * For Each Span function
+ * runs a pointwise span filter over a whole image in parallel
  *
  * @param img - the image to work with
- * @param type - the type of channel to filter
+ * @param fn - the span filter
+ * @param type - passed through to fn
  */
-void changeSingleChannel(Image &img, char type) {
-	int k = 0;
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			if (type == 'R') { // if red
-				img.data[k].green = 0; // set G = 0
-				img.data[k].blue = 0; // B = 0
-			}
-			else if (type == 'G') { // if green
-				img.data[k].red = 0;
-				img.data[k].blue = 0;
-			}
-			else { // else blue
-				img.data[k].red = 0;
-				img.data[k].green = 0;
-			}
-		}
-	}
+void forEachSpan(Image &img, SpanFn fn, char type) {
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		fn(img.data + (size_t)begin*img.width, (end - begin)*img.width, type);
+	});
 }
 
+
 /**
- * Maximize Filter function
- * replaces RGB channels with maximum channel intensity
- * of surrounding 9 pixels
- *
- * @param img - the image to work with
+ * Seconds function
+ * a monotonic clock for timing filters
  */
-void changeMax(Image &img) {
-	Image temp = copyImage(img); // to not clobber, etc
-	int k = 0;
-	int rgbTemp[3] = { 0, 0, 0 };
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			rgbTemp[0] = temp.data[k].red;
-			rgbTemp[1] = temp.data[k].green;
-			rgbTemp[2] = temp.data[k].blue;
-			/**
-			 * this is fairly self explanatory:
-			 * replace each pixel RGB channel with maximum
-			 * channel intensity of adjacent pixels
-			 */
-			if (k - img.width - 1 >= 0) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k - img.width - 1].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k - img.width - 1].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k - img.width - 1].blue);
-			}
-			if (k - img.width >= 0) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k - img.width].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k - img.width].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k - img.width].blue);
-			}
-			if (k - img.width + 1 >= 0) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k - img.width + 1].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k - img.width + 1].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k - img.width + 1].blue);
-			}
-			if ((k - 1) % img.width != 0) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k - 1].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k - 1].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k - 1].blue);
-			}
-			if ((k + 1) % (img.width) != 0) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k + 1].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k + 1].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k + 1].blue);
-			}
-			if (k + img.width - 1 < img.height*img.width) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k + img.width - 1].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k + img.width - 1].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k + img.width - 1].blue);
-			}
-			if (k + img.width < img.height*img.width) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k + img.width].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k + img.width].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k + img.width].blue);
-			}
-			if (k + img.width + 1 < img.height*img.width) {
-				rgbTemp[0] = max(rgbTemp[0], temp.data[k + img.width + 1].red);
-				rgbTemp[1] = max(rgbTemp[1], temp.data[k + img.width + 1].green);
-				rgbTemp[2] = max(rgbTemp[2], temp.data[k + img.width + 1].blue);
-			}
-			img.data[k].red = rgbTemp[0];
-			img.data[k].green = rgbTemp[1];
-			img.data[k].blue = rgbTemp[2];
+double seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/**
+ * Profiling
+ * built with -DPROFILE, every menu action, batch stage, image copy
+ * and redraw records its wall time, pixels, the bytes allocated
+ * while it ran and the thread count. Events come from the GLUT
+ * thread and the filter worker; allocations are counted from any
+ * thread. Without PROFILE the macros expand to nothing
+ */
+#ifdef PROFILE
+typedef struct {
+	char name[32];
+	double start, end; // seconds()
+	size_t pixels, bytes;
+	int threads;
+} ProfileEvent;
+static ProfileEvent *profileEvents = NULL;
+static int profileCount = 0, profileSize = 0;
+static std::atomic<size_t> profileAllocated(0); // bytes, ever
+static pthread_mutex_t profileLock = PTHREAD_MUTEX_INITIALIZER;
+static double profileOrigin = seconds();
+
+/**
+ * Profile Scope type
+ * records one event from its construction to its destruction
+ */
+struct ProfileScope {
+	ProfileEvent event;
+	size_t allocated;
+	ProfileScope(const char *what, char key, size_t pixels) {
+		if (key != 0) { snprintf(event.name, sizeof(event.name), "%s %c", what, key); }
+		else { snprintf(event.name, sizeof(event.name), "%s", what); }
+		event.pixels = pixels;
+		event.threads = threadTotal();
+		allocated = profileAllocated;
+		event.start = seconds();
+	}
+	~ProfileScope() {
+		event.end = seconds();
+		event.bytes = profileAllocated - allocated;
+		pthread_mutex_lock(&profileLock);
+		if (profileCount == profileSize) {
+			profileSize = max(256, profileSize * 2);
+			profileEvents = (ProfileEvent*)realloc(profileEvents, sizeof(ProfileEvent) * profileSize);
 		}
+		profileEvents[profileCount++] = event;
+		pthread_mutex_unlock(&profileLock);
 	}
-}
+};
+#define PROFILE_SCOPE(what, key, pixels) ProfileScope profileScope(what, key, pixels)
+#define PROFILE_ALLOC(bytes) (profileAllocated += (bytes))
 
 /**
- * Minimize Filter function
- * see Max Filter function, it's the exact same
- * but min() instead of max() used
- *
- * @param img - the image to work with
+ * Profile Summary function
+ * prints each kind of event's count, total and mean time, pixel
+ * throughput and allocations
  */
-void changeMin(Image &img) {
-	Image temp = copyImage(img);
-	int k = 0;
-	int rgbTemp[3] = { 0, 0, 0 };
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			rgbTemp[0] = temp.data[k].red;
-			rgbTemp[1] = temp.data[k].green;
-			rgbTemp[2] = temp.data[k].blue;
-			if (k - img.width - 1 >= 0) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k - img.width - 1].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k - img.width - 1].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k - img.width - 1].blue);
-			}
-			if (k - img.width >= 0) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k - img.width].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k - img.width].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k - img.width].blue);
-			}
-			if (k - img.width + 1 >= 0) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k - img.width + 1].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k - img.width + 1].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k - img.width + 1].blue);
-			}
-			if ((k - 1) % img.width != 0) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k - 1].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k - 1].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k - 1].blue);
-			}
-			if ((k + 1) % (img.width) != 0) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k + 1].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k + 1].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k + 1].blue);
-			}
-			if (k + img.width - 1 < img.height*img.width) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k + img.width - 1].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k + img.width - 1].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k + img.width - 1].blue);
-			}
-			if (k + img.width < img.height*img.width) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k + img.width].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k + img.width].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k + img.width].blue);
-			}
-			if (k + img.width + 1 < img.height*img.width) {
-				rgbTemp[0] = min(rgbTemp[0], temp.data[k + img.width + 1].red);
-				rgbTemp[1] = min(rgbTemp[1], temp.data[k + img.width + 1].green);
-				rgbTemp[2] = min(rgbTemp[2], temp.data[k + img.width + 1].blue);
-			}
-			img.data[k].red = rgbTemp[0];
-			img.data[k].green = rgbTemp[1];
-			img.data[k].blue = rgbTemp[2];
+void profileSummary() {
+	pthread_mutex_lock(&profileLock);
+	printf("%-16s %6s %10s %9s %9s %12s %7s\n", "event", "count", "total ms", "mean ms", "MP/s", "alloc bytes", "threads");
+	bool *done = (bool*)calloc(profileCount + 1, sizeof(bool));
+	for (int e = 0; e < profileCount; e++) {
+		if (done[e]) { continue; }
+		int count = 0, threads = 0;
+		double total = 0;
+		size_t pixels = 0, bytes = 0;
+		for (int f = e; f < profileCount; f++) {
+			if (done[f] || strcmp(profileEvents[f].name, profileEvents[e].name) != 0) { continue; }
+			done[f] = true;
+			count++;
+			total += profileEvents[f].end - profileEvents[f].start;
+			pixels += profileEvents[f].pixels;
+			bytes += profileEvents[f].bytes;
+			threads = max(threads, profileEvents[f].threads);
 		}
+		printf("%-16s %6d %10.2f %9.3f %9.1f %12zu %7d\n", profileEvents[e].name, count, total * 1000,
+			total * 1000 / count, total > 0 ? pixels / total / 1e6 : 0.0, bytes, threads);
 	}
+	free(done);
+	pthread_mutex_unlock(&profileLock);
 }
 
 /**
- * Intensity Filter function
- * increase intensity of certain color channels
+ * Profile Trace function
+ * writes the events as Chrome trace-event JSON, for
+ * chrome://tracing or Perfetto
  *
- * @param img - the image to work with
- * @param type - the color channel to intensify
+ * @param name - the file to write
+ * @return - whether it was written
  */
-void changeIntensity(Image &img, char type) {
-	int k = 0;
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			/**
-			 * depending on type, change color channel
-			 * intensity by 15% each time the
-			 * algorithm is run
-			 */
-			if (type == 'R') {
-				img.data[k].red = min(255, img.data[k].red*1.15);
-			}
-			else if (type == 'G') {
-				img.data[k].green = min(255, img.data[k].green * 1.15);
-			}
-			else {
-				img.data[k].blue = min(255, img.data[k].blue * 1.15);
-			}
-		}
+bool profileTrace(const char *name) {
+	FILE *file = fopen(name, "w");
+	if (file == NULL) { return false; }
+	fprintf(file, "{\"traceEvents\": [");
+	for (int e = 0; e < profileCount; e++) {
+		const ProfileEvent &ev = profileEvents[e];
+		fprintf(file, "%s\n {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f, "
+			"\"args\": {\"pixels\": %zu, \"bytes\": %zu, \"threads\": %d}}", e ? "," : "", ev.name,
+			(ev.start - profileOrigin) * 1e6, (ev.end - ev.start) * 1e6, ev.pixels, ev.bytes, ev.threads);
 	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
 }
 
+// what to report at exit (--profile, --trace)
+static bool profileWanted = false;
+static const char *profileTraceName = NULL;
+
 /**
- * Edge Detection function
- * performs both Sobel operations on
- * the image, with a color variant as bonus
- *
- * @param img - the image to work with
- * @param colorToggle - whether or not you need color
+ * Profile Report function
+ * runs at exit, however the program ends
  */
-void bothEdges(Image &img, char colorToggle) {
-	if (colorToggle != 'C') { // if color edges
-		changeGrey(img, 'G');
-	} // otherwise greyscale
-	changeConvolution(img, 'H');
-	changeConvolution(img, 'V');
+void profileReport() {
+	if (profileWanted) { profileSummary(); }
+	if (profileTraceName != NULL && !profileTrace(profileTraceName)) {
+		cerr << "could not write " << profileTraceName << endl;
+	}
 }
+#else
+#define PROFILE_SCOPE(what, key, pixels)
+#define PROFILE_ALLOC(bytes)
+#endif
 
 /**
- * Convolution Filter function
- * applies a specific kernel to the image
+ * Scratch Pool state
+ * filters that can't work in place borrow their scratch images
+ * from here instead of allocating a fresh copy every call. Freed
+ * buffers stay in the pool for the next call, so repeatedly
+ * filtering the same size of image allocates nothing
+ */
+#define POOL_SLOTS 8
+typedef struct {
+	void *data;
+	size_t capacity; // bytes
+	bool inUse;
+} PoolSlot;
+static PoolSlot scratchPool[POOL_SLOTS];
+static pthread_mutex_t scratchLock = PTHREAD_MUTEX_INITIALIZER;
+static std::atomic<unsigned> scratchGeneration(0); // bumped by every trim
+
+/**
+ * Acquire Buffer function
+ * borrows at least `bytes` of scratch memory. The smallest idle
+ * buffer that fits is reused; one more than twice too big is
+ * swapped for an exact fit so a single huge image doesn't pin
+ * its memory forever
  *
- * @param img - the image to work with
- * @param type - the type of kernel to use
+ * @param bytes - size needed
+ * @return - the buffer, give it back with releaseBuffer()
  */
-void changeConvolution(Image &img, char type) {
-	// the kernel as represented as 2D array
-	static int matrices[5][9] = {
-		{ 1, 2, 1, 0, 0, 0, -1, -2, -1 }, // Sobel H
-		{ 1, 0, -1, 2, 0, -2, 1, 0, -1 }, // Sobel V
-		{ 1, 1, 1, 1, 1, 1, 1, 1, 1 }, // Blur
-		{ 1, 2, 1, 2, 4, 2, 1, 2, 1 }, // Gauss. Blur
-		{ 0, -1, 0, -1, 5, -1, 0, -1, 0 } // Sharpen
-	};
-	int *matrix; // get subarray from matrix
-	if (type == 'H') { // Sobel Horizontal
-		matrix = matrices[0];
-	}
-	else if (type == 'V') { // Sobel Vertical
-		matrix = matrices[1];
+void *acquireBuffer(size_t bytes) {
+	pthread_mutex_lock(&scratchLock);
+	PoolSlot *best = NULL, *idle = NULL;
+	for (int s = 0; s < POOL_SLOTS; s++) {
+		PoolSlot &slot = scratchPool[s];
+		if (slot.inUse) { continue; }
+		if (slot.capacity >= bytes && (best == NULL || slot.capacity < best->capacity)) {
+			best = &slot;
+		}
+		if (idle == NULL || slot.capacity < idle->capacity) {
+			idle = &slot;
+		}
 	}
-	else if (type == 'G') { // Gaussian Blur
-		matrix = matrices[3];
+	if (best != NULL && best->capacity / 2 > bytes) {
+		idle = best; // too big, resize it instead
+		best = NULL;
 	}
-	else if (type == 'S') { // Sharpen
-		matrix = matrices[4];
+	if (best == NULL && idle != NULL) {
+		free(idle->data);
+		idle->data = malloc(bytes);
+		PROFILE_ALLOC(bytes);
+		idle->capacity = (idle->data != NULL) ? bytes : 0;
+		best = idle;
 	}
-	else { // Regular Blur
-		matrix = matrices[2];
+	void *data = NULL;
+	if (best != NULL) {
+		best->inUse = true;
+		data = best->data;
 	}
-	// init a temporary image to work with
-	Image tempImg = copyImage(img);
-	int k = 0; // for iterating in a moment
-	int l = 0; // to divide later
-	int rgbTemp[3] = { 0, 0, 0 };
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++, l = 0) {
-			/**
-			 * this is pretty ugly, but it applies the kernel
-			 * operation to a pixel and adjacent pixels
-			 */
-			l += matrix[4]; // initial position k needs to be counted, too
-			// init initial rgbTemp values to be altered later
-			rgbTemp[0] += tempImg.data[k].red*matrix[4];
-			rgbTemp[1] += tempImg.data[k].green*matrix[4];
-			rgbTemp[2] += tempImg.data[k].blue*matrix[4];
-			if (k - img.width - 1 >= 0) { // top-left
-				l += matrix[0];
-				rgbTemp[0] += tempImg.data[k - img.width - 1].red*matrix[0];
-				rgbTemp[1] += tempImg.data[k - img.width - 1].green*matrix[0];
-				rgbTemp[2] += tempImg.data[k - img.width - 1].blue*matrix[0];
-			} 
-			if (k - img.width >= 0) { // above
-				l += matrix[1];
-				rgbTemp[0] += tempImg.data[k - img.width].red*matrix[1];
-				rgbTemp[1] += tempImg.data[k - img.width].green*matrix[1];
-				rgbTemp[2] += tempImg.data[k - img.width].blue*matrix[1];
-			}
-			if (k - img.width + 1 >= 0) { // top-right
-				l += matrix[2];
-				rgbTemp[0] += tempImg.data[k - img.width + 1].red*matrix[2];
-				rgbTemp[1] += tempImg.data[k - img.width + 1].green*matrix[2];
-				rgbTemp[2] += tempImg.data[k - img.width + 1].blue*matrix[2];
-			} 
-			if ((k - 1) % img.width != 0) { // left
-				l += matrix[3];
-				rgbTemp[0] += tempImg.data[k - 1].red*matrix[3];
-				rgbTemp[1] += tempImg.data[k - 1].green*matrix[3];
-				rgbTemp[2] += tempImg.data[k - 1].blue*matrix[3];
-			} 
-			if ((k + 1) % (img.width) != 0) { // right
-				l += matrix[5];
-				rgbTemp[0] += tempImg.data[k + 1].red*matrix[5];
-				rgbTemp[1] += tempImg.data[k + 1].green*matrix[5];
-				rgbTemp[2] += tempImg.data[k + 1].blue*matrix[5];
-			} 
-			if (k + img.width - 1 < img.height*img.width) { // bottom-left
-				l += matrix[6];
-				rgbTemp[0] += tempImg.data[k + img.width - 1].red*matrix[6];
-				rgbTemp[1] += tempImg.data[k + img.width - 1].green*matrix[6];
-				rgbTemp[2] += tempImg.data[k + img.width - 1].blue*matrix[6];
-			} 
-			if (k + img.width < img.height*img.width) { // below
-				l += matrix[7];
-				rgbTemp[0] += tempImg.data[k + img.width].red*matrix[7];
-				rgbTemp[1] += tempImg.data[k + img.width].green*matrix[7];
-				rgbTemp[2] += tempImg.data[k + img.width].blue*matrix[7];
-			} 
-			if (k + img.width + 1 < img.height*img.width) { // bottom-right
-				l += matrix[8];
-				rgbTemp[0] += tempImg.data[k + img.width + 1].red*matrix[8];
-				rgbTemp[1] += tempImg.data[k + img.width + 1].green*matrix[8];
-				rgbTemp[2] += tempImg.data[k + img.width + 1].blue*matrix[8];
-			}
-			/**
-			 * we need to clamp down the bounds so you don't get
-			 * below or above RGB range. Additionally, clamp the divisor
-			 * for edge detection so we don't get division by zero
-			 */
-			img.data[k].red = max(0, min(255, rgbTemp[0] / max(l,1)));
-			img.data[k].green = max(0, min(255, rgbTemp[1] / max(l,1)));
-			img.data[k].blue = max(0, min(255, rgbTemp[2] / max(l,1)));
-			memset(rgbTemp, 0, sizeof(rgbTemp)); // reset this
-		}
+	pthread_mutex_unlock(&scratchLock);
+	if (data == NULL) { // every slot busy: fall back to the heap, released as usual
+		PROFILE_ALLOC(bytes);
+		data = malloc(bytes);
 	}
+	return data;
 }
 
 /**
- * Quantizer Filter function
- * apply a quantized filter to image
- *
- * @param img - the image to work with
- * @param type - the type of filter
+ * Release Buffer function
+ * gives a buffer from acquireBuffer() back to the pool
  */
-void changeQuantize(Image &img, char type) {
-	srand(time(NULL)); // seed for random
-	int k = 0; // kth pixel
-	int highestIndex = 0; // the index of the highest value
-	int col[3] = { 0, 0, 0 }; // placeholder to put temp color values
-	int vals[9][3] = {
-		{ 255, 0, 0 },{ 0, 255, 0 },{ 0, 0, 255 }, // red, green, blue
-		{ 255, 255, 255 },{ 0, 0, 0 },{ 128, 128, 128 }, // black, white, grey
-		{ 128, 128, 0 },{ 0, 128, 128 },{ 128, 0, 128 } // combos of RGB
-	};
-	if (type == 'R') { // if random modifier
-		for (int i = 0; i < 9; i++) { // 9 colors
-			for (int j = 0; j < 3; j++) { // 3 channels per color
-				vals[i][j] = rand() % 255; // random value 0-255 per channel
-			}
-		}
-	}
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			col[0] = img.data[k].red;
-			col[1] = img.data[k].green;
-			col[2] = img.data[k].blue;
-			// find index of closest color
-			highestIndex = checkCloser(col, vals);
-			// replace channel with highest of palette
-			img.data[k].red = vals[highestIndex][0];
-			img.data[k].green = vals[highestIndex][1];
-			img.data[k].blue = vals[highestIndex][2];
+void releaseBuffer(void *data) {
+	pthread_mutex_lock(&scratchLock);
+	for (int s = 0; s < POOL_SLOTS; s++) {
+		if (scratchPool[s].inUse && scratchPool[s].data == data) {
+			scratchPool[s].inUse = false;
+			pthread_mutex_unlock(&scratchLock);
+			return;
 		}
 	}
+	pthread_mutex_unlock(&scratchLock);
+	free(data); // an overflow allocation
 }
 
 /**
- * Closest Neighbor function
- * finds closer pixel based on Euclidean geometry in RGB-space
- *
- * @param col - 
- * @param rgbVals -
- * @return - the closest index
+ * Trim Scratch function
+ * frees every idle pooled buffer, and has each thread free its
+ * thread scratch the next time it asks for some. Only call it
+ * between jobs, while no filter holds thread scratch
  */
-int checkCloser(int col[3], int rgbVals[9][3]) {
-	int highMatch[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-	int r, g, b;
-	int euDist;
-	float squareA, squareB;
-	int tempHighest = 0; // temporary highest
-	int highestIndex = 0; // index of highest
-	for (int i = 0; i < 9; i++) {
-		r = rgbVals[i][0];
-		g = rgbVals[i][1];
-		b = rgbVals[i][2];
-		// distance in RGB-space
-		squareA = (col[0] - r) * (col[0] - r);
-		squareB = (col[2] - b) * (col[2] - b);
-		euDist = (int)sqrt(squareA + squareB);
-		highMatch[i] = euDist; // insert potential highest values into array
-	}
-	// finds the highest value and the index of the highest value
-	for (int i = 0; i < 9; i++) {
-		if (tempHighest < highMatch[i]) {
-			tempHighest = highMatch[i];
-			highestIndex = i;
+void trimScratch() {
+	scratchGeneration++;
+	pthread_mutex_lock(&scratchLock);
+	for (int s = 0; s < POOL_SLOTS; s++) {
+		if (!scratchPool[s].inUse) {
+			free(scratchPool[s].data);
+			scratchPool[s].data = NULL;
+			scratchPool[s].capacity = 0;
 		}
 	}
-	return highestIndex; // return the index of the closest match
+	pthread_mutex_unlock(&scratchLock);
 }
 
 /**
- * Negative Filter function
- * changes image to color negative
+ * Thread Scratch function
+ * per thread working memory for row and strip kernels, grown as
+ * needed and kept until trimScratch() or the thread's exit. A few
+ * independent slots so one kernel can hold more than one buffer
  *
- * @param img - the image to negate
+ * @param slot - which buffer, 0 to THREAD_SLOTS-1
+ * @param bytes - size needed
+ * @return - the buffer
  */
-void changeNegative(Image &img) {
-	int k = 0;
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			// basically just set to |RGB-255|
-			img.data[k].red = abs(img.data[k].red - 255);
-			img.data[k].green = abs(img.data[k].green - 255);
-			img.data[k].blue = abs(img.data[k].blue - 255);
+#define THREAD_SLOTS 4
+struct ThreadSlots {
+	void *scratch[THREAD_SLOTS];
+	size_t size[THREAD_SLOTS];
+	unsigned generation; // of the last trim seen
+	~ThreadSlots() {
+		for (int s = 0; s < THREAD_SLOTS; s++) { free(scratch[s]); }
+	}
+};
+void *threadScratch(int slot, size_t bytes) {
+	static thread_local ThreadSlots own;
+	unsigned generation = scratchGeneration.load(std::memory_order_relaxed);
+	if (own.generation != generation) { // trimmed since this thread last asked
+		for (int s = 0; s < THREAD_SLOTS; s++) {
+			free(own.scratch[s]);
+			own.scratch[s] = NULL;
+			own.size[s] = 0;
 		}
+		own.generation = generation;
+	}
+	if (bytes > own.size[slot]) {
+		free(own.scratch[slot]);
+		own.scratch[slot] = malloc(bytes);
+		own.size[slot] = bytes;
+		PROFILE_ALLOC(bytes);
 	}
+	return own.scratch[slot];
 }
 
 /**
- * Sepia Filter function
- * applies a sepia filter to the image
+ * Scratch Copy function
+ * a pooled copy of an image, copied band by band in parallel
  *
- * @param img - the image to work with
+ * @param img - the image to copy
+ * @return - the copy, give it back with releaseScratch()
  */
-void changeSepia(Image &img) {
-	int k = 0;
-	for (int i = 0; i < img.width; i++) {
-		for (int j = 0; j < img.height; j++, k++) {
-			// values taken from online, standard sepia values
-			img.data[k].red = min(255, 
-				(img.data[k].red*0.393) + 
-				(img.data[k].green*0.769) + 
-				(img.data[k].blue*0.189));
-			img.data[k].green = min(255, 
-				(img.data[k].red*0.349) + 
-				(img.data[k].green*0.686) + 
-				(img.data[k].blue*0.168));
-			img.data[k].blue = min(255, 
-				(img.data[k].red*0.272) + 
-				(img.data[k].green*0.534) + 
-				(img.data[k].blue*0.131));
-		}
-	}
+Image scratchCopy(const Image &img) {
+	Image copy = img;
+	copy.bitmap = NULL;
+	copy.mapping = NULL;
+	copy.data = (Pixel*)acquireBuffer(sizeof(Pixel)*img.width*img.height);
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		memcpy(copy.data + (size_t)begin*img.width, img.data + (size_t)begin*img.width,
+			sizeof(Pixel)*img.width*(end - begin));
+	});
+	return copy;
+}
+
+void releaseScratch(Image &img) {
+	releaseBuffer(img.data);
+	img.data = NULL;
 }
 
+// window radius of the max/min filters (--radius)
+int morphRadius = 1;
+
+// gradient magnitude for edge detection, '1' L1 or '2' L2 (--edge-norm)
+char edgeNorm = '2';
+
+// highest instruction set filters may use, see simdLevel() (--simd)
+int simdCap = 2;
+
 /**
-* Display Image function
-* taken from template solution
+* SIMD Level function
+* what the vector paths may use: 0 for plain C, 1 for SSE4.1
+* (and SSSE3), 2 for AVX2. Detected once, then capped by simdCap
+*
+* @return - the usable level
 */
-void displayImage(void) {
-	glDrawPixels(workBuffer.width, workBuffer.height, GL_RGB, GL_UNSIGNED_BYTE, (GLubyte*)workBuffer.data);
-	glFlush();
+int simdLevel() {
+	static const int detected = []() { // once, even with batch workers racing here
+		int level = 0;
+#ifdef HAVE_X86_SIMD
+		if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3")) { level = 1; }
+		if (level == 1 && __builtin_cpu_supports("avx2")) { level = 2; }
+#endif
+		return level;
+	}();
+	return min(detected, simdCap);
 }
 
 /**
-* Copy Image function
-* make a copy from Image A to Image B
+* Swizzle Row function
+* copies a row of 24 bit pixels while swapping the first and
+* third byte of each, which converts FreeImage's BGR scanlines
+* to RGB Pixels and back again
 *
-* @param i - the image to copy
-* @return - a copy of that image
+* @param dst - the row to write
+* @param src - the row to read
+* @param width - number of pixels in the row
 */
-Image copyImage(Image img) {
-	Image tempImage; // create temporary image
-	// copy dimensions over
-	tempImage.height = img.height;
-	tempImage.width = img.width;
-	// allocate memory for next pixel data
-	tempImage.data = (Pixel*)malloc(sizeof(Pixel)*img.width*img.height);
-	// copy memory from i to return image
-	memcpy(tempImage.data, img.data, sizeof(Pixel)*img.width*img.height);
-	return tempImage; // return the copy
+void swizzleRowScalar(GLubyte *dst, const GLubyte *src, int width) {
+	for (int j = 0; j < width; j++, dst += 3, src += 3) {
+		GLubyte first = src[0]; // dst may alias src
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = first;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("ssse3")))
+void swizzleRowSSSE3(GLubyte *dst, const GLubyte *src, int width) {
+	// five pixels per shuffle, the 16th byte passes through untouched
+	const __m128i order = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+	int j = 0;
+	// 16 byte loads need a sixth pixel behind the five being swapped
+	for (; j + 6 <= width; j += 5, dst += 15, src += 15) {
+		__m128i v = _mm_loadu_si128((const __m128i*)src);
+		_mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(v, order));
+	}
+	swizzleRowScalar(dst, src, width - j);
 }
 
 /**
- * Menu Display function
- * displays CLI menu to user
+ * Plane Masks
+ * byte shuffles between 48 interleaved bytes and 16 bytes of each
+ * plane: split[c][v] picks channel c out of the vth 16 bytes, and
+ * merge[v][c] places plane c's bytes in the vth 16 bytes. Index
+ * 0x80 zeroes a byte, so three shuffles OR together
  */
-void printMenu() {
-	cout << "Q: Quit\tR: Reset\t S: Save" << endl;
-	cout << "\nDisplay" << endl;
-	cout << "1: Greyscale\t2: NTSC\t3: Monochrome\t4: Channel Swap" << endl;
-	cout << "5: Pure R\t6: Pure G\t7: Pure B" << endl;
-	cout << "\nBasic Channel Filters" << endl;
-	cout << "8: Max\t9: Min\t0: Int R\ta: Int G\tb: Int B" << endl;
-	cout << "\nConvolution Filters" << endl;
-	cout << "c: GS Edges\td: Color Edges" << endl;
-	cout << "e: Blur\tf: Gauss. Blur\tg: Sharpen" << endl;
-	cout << "\nQuantize Filters" << endl;
-	cout << "h: Fixed RGB\ti: Random RGB" << endl;
-	cout << "\nCustom Filters" << endl;
-	cout << "j: Image Negative\tk: Sepia Filter" << endl;
+typedef struct {
+	GLubyte split[3][3][16], merge[3][3][16];
+} PlaneMasks;
+
+const PlaneMasks &planeMasks() {
+	static const PlaneMasks masks = []() { // built once, even with threads racing here
+		PlaneMasks m;
+		for (int a = 0; a < 3; a++) {
+			for (int b = 0; b < 3; b++) {
+				for (int t = 0; t < 16; t++) {
+					int from = 3 * t + a, to = 16 * a + t; // pixel t channel a, byte t of vector a
+					m.split[a][b][t] = (from / 16 == b) ? from % 16 : 0x80;
+					m.merge[a][b][t] = (to % 3 == b) ? to / 3 : 0x80;
+				}
+			}
+		}
+		return m;
+	}();
+	return masks;
 }
+
 /**
- * Menu Handler function
- * Glut needs argument for menu to perform operations
- * on image. The CLI menu serves as instruction for this
- * switch statement
+ * Split Pixels function
+ * the 16 pixels at in as one vector of 16 bytes per channel
  */
-void menu(unsigned char key, int x, int y) {
-	switch (key) {
-	case 'q': { exit(0); break; }
-	case 'r': { workBuffer = copyImage(saveBuffer);	glutPostRedisplay(); break; }
-	case 's': {	saveImage("backup.tif", workBuffer); break; }
-	case '1': { changeGrey(workBuffer, 'G'); glutPostRedisplay(); break; }
-	case '2': {	changeGrey(workBuffer, 'N'); glutPostRedisplay(); break; }
-	case '3': { changeMonochrome(workBuffer); glutPostRedisplay(); break; }
-	case '4': { changeSwap(workBuffer);	glutPostRedisplay(); break; }
-	case '5': { changeSingleChannel(workBuffer, 'R'); glutPostRedisplay(); break; }
-	case '6': { changeSingleChannel(workBuffer, 'G'); glutPostRedisplay(); break; }
-	case '7': { changeSingleChannel(workBuffer, 'B'); glutPostRedisplay(); break; }
-	case '8': { changeMax(workBuffer); glutPostRedisplay(); break; }
-	case '9': { changeMin(workBuffer); glutPostRedisplay();	break; }
-	case '0': { changeIntensity(workBuffer, 'R'); glutPostRedisplay(); break; }
-	case 'a': { changeIntensity(workBuffer, 'G'); glutPostRedisplay(); break; }
-	case 'b': { changeIntensity(workBuffer, 'B'); glutPostRedisplay(); break; }
-	case 'c': { bothEdges(workBuffer, 'C'); glutPostRedisplay(); break;	}
-	case 'd': { bothEdges(workBuffer, 'N'); glutPostRedisplay(); break;	}
-	case 'e': { changeConvolution(workBuffer, 'C'); glutPostRedisplay(); break;	}
-	case 'f': { changeConvolution(workBuffer, 'G'); glutPostRedisplay(); break; }
-	case 'g': { changeConvolution(workBuffer, 'S');	glutPostRedisplay(); break; }
-	case 'h': { changeQuantize(workBuffer, 'F'); glutPostRedisplay();	break; }
-	case 'i': { changeQuantize(workBuffer, 'R'); glutPostRedisplay();	break; }
-	case 'j': { changeNegative(workBuffer); glutPostRedisplay(); break; }
-	case 'k': { changeSepia(workBuffer); glutPostRedisplay(); break; }
+__attribute__((target("ssse3")))
+inline void splitPixels(const GLubyte *in, __m128i *plane) {
+	const PlaneMasks &m = planeMasks();
+	__m128i v[3];
+	for (int b = 0; b < 3; b++) { v[b] = _mm_loadu_si128((const __m128i*)(in + 16 * b)); }
+	for (int c = 0; c < 3; c++) {
+		__m128i x = _mm_setzero_si128();
+		for (int b = 0; b < 3; b++) {
+			x = _mm_or_si128(x, _mm_shuffle_epi8(v[b], _mm_loadu_si128((const __m128i*)m.split[c][b])));
+		}
+		plane[c] = x;
 	}
 }
 
-int main(int argc, char** argv) {
-	saveBuffer = imageLoader(argv[1]); // load save buffer
+/**
+ * Merge Pixels function
+ * splitPixels() backwards, writing 16 pixels to out
+ */
+__attribute__((target("ssse3")))
+inline void mergePixels(GLubyte *out, const __m128i *plane) {
+	const PlaneMasks &m = planeMasks();
+	for (int v = 0; v < 3; v++) {
+		__m128i x = _mm_setzero_si128();
+		for (int c = 0; c < 3; c++) {
+			x = _mm_or_si128(x, _mm_shuffle_epi8(plane[c], _mm_loadu_si128((const __m128i*)m.merge[v][c])));
+		}
+		_mm_storeu_si128((__m128i*)(out + 16 * v), x);
+	}
+}
+#endif
+
+/**
+* Swizzle Row dispatch
+* picks the fastest swizzle this CPU supports
+*/
+void swizzleRow(GLubyte *dst, const GLubyte *src, int width) {
+#ifdef HAVE_X86_SIMD
+	if (simdLevel() >= 1) {
+		swizzleRowSSSE3(dst, src, width);
+		return;
+	}
+#endif
+	swizzleRowScalar(dst, src, width);
+}
+
+/**
+ * Cache Header type
+ * starts a raw image cache file (.ifc), which is this header
+ * padded to CACHE_OFFSET bytes followed by the rows of Pixels,
+ * bottom row first, exactly as they sit in an Image
+ */
+#define CACHE_MAGIC "IFC1"
+#define CACHE_OFFSET 4096 // keeps the pixels page aligned
+typedef struct {
+	char magic[4];
+	uint32_t width, height;
+	uint32_t offset; // where the pixels start
+} CacheHeader;
+
+// whether inputs are cached beside themselves as name.ifc (--cache)
+bool cacheMode = false;
+
+/**
+ * Cache Name function
+ * whether a filename is a raw image cache
+ */
+bool isCacheName(const char *name) {
+	const char *dot = strrchr(name, '.');
+	return dot != NULL && strcasecmp(dot, ".ifc") == 0;
+}
+
+/**
+ * Map Cache function
+ * opens a cache file by mapping it, so the Image's pixels are the
+ * file's pages and load only as filters touch them. The mapping is
+ * private: filters write to copy-on-write pages and the file on
+ * disk never changes
+ *
+ * @param name - the cache file
+ * @param img - receives the image
+ * @return - whether the file was a valid cache
+ */
+bool mapCache(const char *name, Image &img) {
+	int file = open(name, O_RDONLY);
+	if (file < 0) { return false; }
+	struct stat info;
+	CacheHeader header;
+	bool valid = fstat(file, &info) == 0 && pread(file, &header, sizeof(header), 0) == sizeof(header) &&
+		memcmp(header.magic, CACHE_MAGIC, 4) == 0 &&
+		(size_t)info.st_size == header.offset + sizeof(Pixel) * (size_t)header.width * header.height;
+	void *mapping = valid ? mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	close(file); // the mapping keeps the file open
+	if (mapping == MAP_FAILED) { return false; }
+	img.width = header.width;
+	img.height = header.height;
+	img.bitmap = NULL;
+	img.mapping = mapping;
+	img.mapped = info.st_size;
+	img.data = (Pixel*)((char*)mapping + header.offset);
+	return true;
+}
+
+/**
+ * Write Cache function
+ * saves an image as a cache file, writing a temporary file first
+ * so a run that maps the cache never sees it half written
+ *
+ * @param name - the cache file
+ * @param img - the image to save
+ * @return - whether it was saved
+ */
+bool writeCache(const char *name, const Image &img) {
+	char temp[4096];
+	snprintf(temp, sizeof(temp), "%s.%d.tmp", name, (int)getpid());
+	FILE *file = fopen(temp, "wb");
+	if (file == NULL) { return false; }
+	char header[CACHE_OFFSET];
+	memset(header, 0, sizeof(header));
+	CacheHeader *h = (CacheHeader*)header;
+	memcpy(h->magic, CACHE_MAGIC, 4);
+	h->width = img.width;
+	h->height = img.height;
+	h->offset = CACHE_OFFSET;
+	size_t pixels = (size_t)img.width * img.height;
+	bool saved = fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+		fwrite(img.data, sizeof(Pixel), pixels, file) == pixels;
+	saved = (fclose(file) == 0) && saved && rename(temp, name) == 0;
+	if (!saved) { remove(temp); }
+	return saved;
+}
+
+/**
+* Decode Image function
+* loads an input image into memory, a whole scanline at a time
+*
+* @param name - the filename of the loaded file
+* @return - image save buffer, with NULL data if loading failed
+*/
+Image decodeImage(const char *name) {
+	FIBITMAP *inputImage; // container for input image
+	inputImage = FreeImage_Load(FIF_TIFF, name, 0); //attempts to load
+	Image outputImage; // for returning later
+	outputImage.bitmap = NULL;
+	outputImage.mapping = NULL;
+	if (inputImage != NULL && FreeImage_GetBPP(inputImage) != 24) {
+		// palettized, grey or 32 bit TIFFs are widened to 24 bit first
+		FIBITMAP *converted = FreeImage_ConvertTo24Bits(inputImage);
+		FreeImage_Unload(inputImage);
+		inputImage = converted;
+	}
+	if (inputImage == NULL) { // unreadable or not a TIFF
+		outputImage.data = NULL;
+		outputImage.width = outputImage.height = 0;
+		return outputImage;
+	}
+	// set up image dimensions
+	outputImage.width = FreeImage_GetWidth(inputImage);
+	outputImage.height = FreeImage_GetHeight(inputImage);
+#if FI_RGBA_RED == 0 && FI_RGBA_BLUE == 2
+	/**
+	 * on RGB ordered builds an unpadded bitmap already is
+	 * an array of Pixels, so just keep it instead of copying
+	 */
+	if (FreeImage_GetPitch(inputImage) == outputImage.width * sizeof(Pixel)) {
+		outputImage.data = (Pixel*)FreeImage_GetBits(inputImage);
+		outputImage.bitmap = inputImage;
+		return outputImage;
+	}
+#endif
+	Pixel *data; // blank pixel structure
+	 // ensure correct size
+	data = (Pixel*)malloc((size_t)(outputImage.height)*(outputImage.width) * sizeof(Pixel));
+	for (int i = 0; i < outputImage.height; i++) {
+		// scanline i and row i of the image are both counted from the bottom
+		Pixel *row = data + (size_t)i*outputImage.width;
+#if FI_RGBA_RED == 0 && FI_RGBA_BLUE == 2
+		memcpy(row, FreeImage_GetScanLine(inputImage, i), outputImage.width * sizeof(Pixel));
+#else
+		swizzleRow((GLubyte*)row, FreeImage_GetScanLine(inputImage, i), outputImage.width);
+#endif
+	}
+	FreeImage_Unload(inputImage); // no longer needed in memory
+	outputImage.data = data; // initialize image pixels
+	return outputImage; // to instantiate image in main driver
+}
+
+/**
+* Image Loader function
+* loads an image, mapping a cache file rather than decoding when
+* there is one: either the file itself is a .ifc, or with --cache
+* a name.ifc beside it at least as new as it. With --cache a
+* decoded image also leaves its .ifc behind for next time
+*
+* @param name - the filename of the loaded file
+* @return - image save buffer, with NULL data if loading failed
+*/
+Image imageLoader(const char *name) {
+	Image img;
+	if (isCacheName(name)) {
+		if (!mapCache(name, img)) {
+			img.data = NULL;
+			img.width = img.height = 0;
+		}
+		return img;
+	}
+	char cache[4096];
+	snprintf(cache, sizeof(cache), "%s.ifc", name);
+	struct stat source, cached;
+	if (cacheMode && stat(name, &source) == 0 && stat(cache, &cached) == 0 &&
+		cached.st_mtime >= source.st_mtime && mapCache(cache, img)) {
+		return img;
+	}
+	img = decodeImage(name);
+	if (cacheMode && img.data != NULL && !writeCache(cache, img)) {
+		cerr << "could not write cache " << cache << endl;
+	}
+	return img;
+}
+
+/**
+* Release Image function
+* frees an image's pixels however they were allocated
+*
+* @param img - the image to release
+*/
+void releaseImage(Image &img) {
+	if (img.bitmap != NULL) { // pixels belong to FreeImage
+		FreeImage_Unload(img.bitmap);
+	}
+	else if (img.mapping != NULL) { // pixels are a cache file's pages
+		munmap(img.mapping, img.mapped);
+	}
+	else {
+		free(img.data);
+	}
+	img.data = NULL;
+	img.bitmap = NULL;
+	img.mapping = NULL;
+}
+
+/**
+* Save Image function
+* effectively the load image function in reverse, or a raw
+* cache file when the name ends in .ifc
+*
+* @param name - filename to save as
+* @param i - the image to save
+* @return - whether the file was written
+*/
+bool saveImage(const char *name, Image img) {
+	if (isCacheName(name)) { // raw, for the next run to map
+		return writeCache(name, img);
+	}
+	if (img.bitmap != NULL) { // pixels already live in a bitmap
+		return FreeImage_Save(FIF_TIFF, img.bitmap, name, 0);
+	}
+	FIBITMAP *outputImage; // output image container
+	// allocate memory to output image container
+	outputImage = FreeImage_Allocate(img.width, img.height, 24, 0, 0, 0);
+	/**
+	 * refer to load image function to get the gist
+	 * as this is just the same code more or less
+	 */
+	for (int i = 0; i < img.height; i++) {
+		Pixel *row = img.data + (size_t)i*img.width;
+#if FI_RGBA_RED == 0 && FI_RGBA_BLUE == 2
+		memcpy(FreeImage_GetScanLine(outputImage, i), row, img.width * sizeof(Pixel));
+#else
+		swizzleRow(FreeImage_GetScanLine(outputImage, i), (GLubyte*)row, img.width);
+#endif
+	}
+	bool saved = FreeImage_Save(FIF_TIFF, outputImage, name, 0);
+	FreeImage_Unload(outputImage);
+	return saved;
+}
+
+/**
+ * Luminance function
+ * weighted sum of a pixel's channels, truncated after every term
+ * the way the greyscale filters always have been
+ */
+inline int luminance(const Pixel &p, double rMult, double gMult, double bMult) {
+	int lum = 0;
+	lum += p.red*rMult;
+	lum += p.green*gMult;
+	lum += p.blue*bMult;
+	return lum;
+}
+
+/**
+ * Grey Span function
+ * the per pixel work of changeGrey() over n pixels in doubles,
+ * picking the weights inside. The runtime dispatched form, kept as
+ * the baseline --bench-specialized measures greySpanFor() against
+ */
+void greySpan(Pixel *p, int n, char type) {
+	int lum = 0; // luminance
+	double rMult, gMult, bMult; // multipliers
+	if (type == 'N') { // NTSC greyscale
+		rMult = 0.30;
+		gMult = 0.59;
+		bMult = 0.11;
+	}
+	else { // regular greyscale
+		rMult = 0.33;
+		gMult = 0.33;
+		bMult = 0.33;
+	}
+	for (int k = 0; k < n; k++) {
+		lum = luminance(p[k], rMult, gMult, bMult);
+		p[k].red = lum; // apply
+		p[k].green = lum;
+		p[k].blue = lum;
+	}
+}
+
+/**
+ * Grey Weights
+ * the greyscale weights as compile time constants, indexed by
+ * GREY_NTSC or GREY_EVEN. greyFixed holds the same weights as 16
+ * bit fractions, rounded up so that (v * q) >> 16 truncates to the
+ * same whole number as v * w in doubles for every byte v, which
+ * greyExact() checks at compile time. The fixed point greyscale is
+ * therefore bit for bit the double formula
+ */
+#define GREY_EVEN 0
+#define GREY_NTSC 1
+constexpr double greyWeights[2][3] = { { 0.33, 0.33, 0.33 }, { 0.30, 0.59, 0.11 } };
+
+constexpr int greyQ16(double w) {
+	return (int)(w * 65536) + 1;
+}
+
+constexpr bool greyExact(double w) {
+	for (int v = 0; v < 256; v++) {
+		if ((v * greyQ16(w)) >> 16 != (int)(v * w)) { return false; }
+	}
+	return true;
+}
+
+constexpr int greyFixed[2][3] = {
+	{ greyQ16(greyWeights[0][0]), greyQ16(greyWeights[0][1]), greyQ16(greyWeights[0][2]) },
+	{ greyQ16(greyWeights[1][0]), greyQ16(greyWeights[1][1]), greyQ16(greyWeights[1][2]) }
+};
+static_assert(greyExact(greyWeights[0][0]) && greyExact(greyWeights[1][0]) &&
+	greyExact(greyWeights[1][1]) && greyExact(greyWeights[1][2]), "a grey weight has no exact 16 bit fraction");
+
+/**
+ * Grey Level function
+ * luminance() in fixed point with one of the greyFixed weights
+ */
+inline int greyLevel(const Pixel &p, const int *q) {
+	return ((p.red * q[0]) >> 16) + ((p.green * q[1]) >> 16) + ((p.blue * q[2]) >> 16);
+}
+
+/**
+ * Grey Span Fixed function
+ * greySpan() with the weights baked in as fixed point, so each
+ * variant is a straight integer loop with no branches
+ */
+template <int W>
+void greySpanFixed(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		int lum = greyLevel(p[k], greyFixed[W]);
+		p[k].red = lum;
+		p[k].green = lum;
+		p[k].blue = lum;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Grey Vector function
+ * the fixed point luminance of 16 split pixels as two vectors of 8
+ * 16 bit sums, each term a high half multiply so it truncates just
+ * as greyLevel() does
+ */
+__attribute__((target("ssse3")))
+inline void greyVector(const __m128i *plane, const int *q, __m128i &lo, __m128i &hi) {
+	const __m128i zero = _mm_setzero_si128();
+	lo = hi = zero;
+	for (int c = 0; c < 3; c++) {
+		__m128i weight = _mm_set1_epi16((short)q[c]);
+		lo = _mm_add_epi16(lo, _mm_mulhi_epu16(_mm_unpacklo_epi8(plane[c], zero), weight));
+		hi = _mm_add_epi16(hi, _mm_mulhi_epu16(_mm_unpackhi_epi8(plane[c], zero), weight));
+	}
+}
+
+template <int W>
+__attribute__((target("ssse3")))
+void greySpanSSSE3(Pixel *p, int n, char type) {
+	GLubyte *bytes = (GLubyte*)p;
+	int k = 0;
+	for (; k + 16 <= n; k += 16, bytes += 48) {
+		__m128i plane[3], lo, hi;
+		splitPixels(bytes, plane);
+		greyVector(plane, greyFixed[W], lo, hi);
+		plane[0] = plane[1] = plane[2] = _mm_packus_epi16(lo, hi);
+		mergePixels(bytes, plane);
+	}
+	greySpanFixed<W>(p + k, n - k, type);
+}
+#endif
+
+/**
+ * Grey Span For function
+ * the specialized grey span for a type and SIMD level, looked up
+ * once per call
+ */
+SpanFn greySpanFor(char type) {
+#ifdef HAVE_X86_SIMD
+	static const SpanFn vector[2] = { greySpanSSSE3<GREY_EVEN>, greySpanSSSE3<GREY_NTSC> };
+	if (simdLevel() >= 1) { return vector[type == 'N']; }
+#endif
+	static const SpanFn spans[2] = { greySpanFixed<GREY_EVEN>, greySpanFixed<GREY_NTSC> };
+	return spans[type == 'N'];
+}
+
+/**
+ * Greyscale Filter function
+ * applies one of two GS filters to image
+ *
+ * @param img - the image to work with
+ * @param type - the type of GS algorithm to use
+ */
+void changeGrey(Image &img, char type) {
+	forEachSpan(img, greySpanFor(type), type);
+}
+
+/**
+ * Monochrome Span Float function
+ * the per pixel work of changeMonochrome() over n pixels in
+ * doubles, as it always was. --bench-specialized times the fixed
+ * point spans against it
+ */
+void monochromeSpanFloat(Pixel *p, int n, char type) {
+	int lum = 0;
+	for (int k = 0; k < n; k++) {
+		lum = luminance(p[k], 0.33, 0.33, 0.33);
+		/** if higher than half, set to black
+		 * if lower, set to white, etc
+		 */
+		p[k].red = (lum > 128) ? 255 : 0;
+		p[k].green = (lum > 128) ? 255 : 0;
+		p[k].blue = (lum > 128) ? 255 : 0;
+	}
+}
+
+/**
+ * Monochrome Span function
+ * monochromeSpanFloat() on the exact fixed point greyscale
+ */
+void monochromeSpan(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		GLubyte v = (greyLevel(p[k], greyFixed[GREY_EVEN]) > 128) ? 255 : 0;
+		p[k].red = v;
+		p[k].green = v;
+		p[k].blue = v;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("ssse3")))
+void monochromeSpanSSSE3(Pixel *p, int n, char type) {
+	const __m128i half = _mm_set1_epi16(128);
+	GLubyte *bytes = (GLubyte*)p;
+	int k = 0;
+	for (; k + 16 <= n; k += 16, bytes += 48) {
+		__m128i plane[3], lo, hi;
+		splitPixels(bytes, plane);
+		greyVector(plane, greyFixed[GREY_EVEN], lo, hi);
+		// all ones above half, packed with signed saturation to 0xff
+		plane[0] = plane[1] = plane[2] = _mm_packs_epi16(_mm_cmpgt_epi16(lo, half), _mm_cmpgt_epi16(hi, half));
+		mergePixels(bytes, plane);
+	}
+	monochromeSpan(p + k, n - k, type);
+}
+#endif
+
+/**
+ * Monochrome Span For function
+ * the monochrome span for the SIMD level
+ */
+SpanFn monochromeSpanFor() {
+#ifdef HAVE_X86_SIMD
+	if (simdLevel() >= 1) { return monochromeSpanSSSE3; }
+#endif
+	return monochromeSpan;
+}
+
+/**
+ * Monochrome Filter function
+ * changes image to B+W
+ *
+ * @param img - the image to binarize
+ */
+void changeMonochrome(Image &img) {
+	forEachSpan(img, monochromeSpanFor(), 0);
+}
+
+/**
+ * Sepia Weights
+ * the standard sepia matrix, a row per output channel, and the
+ * same as 15 bit fractions. Summed in 32 bits and truncated, the
+ * fixed point result is within 1 of the double one for every
+ * colour, and off at all for fewer than 1 in 1000
+ */
+constexpr double sepiaWeights[3][3] = {
+	{ 0.393, 0.769, 0.189 }, { 0.349, 0.686, 0.168 }, { 0.272, 0.534, 0.131 }
+};
+
+constexpr int sepiaQ15(double w) {
+	return (int)(w * 32768 + 0.5);
+}
+
+constexpr int sepiaFixed[3][3] = {
+	{ sepiaQ15(sepiaWeights[0][0]), sepiaQ15(sepiaWeights[0][1]), sepiaQ15(sepiaWeights[0][2]) },
+	{ sepiaQ15(sepiaWeights[1][0]), sepiaQ15(sepiaWeights[1][1]), sepiaQ15(sepiaWeights[1][2]) },
+	{ sepiaQ15(sepiaWeights[2][0]), sepiaQ15(sepiaWeights[2][1]), sepiaQ15(sepiaWeights[2][2]) }
+};
+
+/**
+ * Sepia Span Float function
+ * the per pixel work of changeSepia() over n pixels in doubles,
+ * every channel mixed from the pixel as it was. The baseline for
+ * --bench-specialized
+ */
+void sepiaSpanFloat(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		Pixel was = p[k];
+		GLubyte *out = (GLubyte*)(p + k);
+		for (int c = 0; c < 3; c++) {
+			out[c] = min(255, was.red*sepiaWeights[c][0] + was.green*sepiaWeights[c][1] + was.blue*sepiaWeights[c][2]);
+		}
+	}
+}
+
+/**
+ * Sepia Span function
+ * sepiaSpanFloat() in fixed point
+ */
+void sepiaSpan(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		int r = p[k].red, g = p[k].green, b = p[k].blue;
+		GLubyte *out = (GLubyte*)(p + k);
+		for (int c = 0; c < 3; c++) {
+			int v = (r * sepiaFixed[c][0] + g * sepiaFixed[c][1] + b * sepiaFixed[c][2]) >> 15;
+			out[c] = min(255, v);
+		}
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Sepia SSSE3 function
+ * 16 pixels at a time: red and green interleaved as 16 bit pairs
+ * meet their weights in one multiply-add, blue paired with zero in
+ * another, and the 32 bit sums shift down and pack with unsigned
+ * saturation, which is the clamp to 255
+ */
+__attribute__((target("ssse3")))
+void sepiaSpanSSSE3(Pixel *p, int n, char type) {
+	const __m128i zero = _mm_setzero_si128();
+	__m128i rg[3], bz[3];
+	for (int c = 0; c < 3; c++) {
+		rg[c] = _mm_set1_epi32(sepiaFixed[c][0] | (sepiaFixed[c][1] << 16));
+		bz[c] = _mm_set1_epi32(sepiaFixed[c][2]);
+	}
+	GLubyte *bytes = (GLubyte*)p;
+	int k = 0;
+	for (; k + 16 <= n; k += 16, bytes += 48) {
+		__m128i plane[3], wide[2][3];
+		splitPixels(bytes, plane);
+		for (int c = 0; c < 3; c++) {
+			wide[0][c] = _mm_unpacklo_epi8(plane[c], zero);
+			wide[1][c] = _mm_unpackhi_epi8(plane[c], zero);
+		}
+		for (int c = 0; c < 3; c++) {
+			__m128i half[2];
+			for (int h = 0; h < 2; h++) {
+				const __m128i *w = wide[h];
+				__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(w[0], w[1]), rg[c]),
+					_mm_madd_epi16(_mm_unpacklo_epi16(w[2], zero), bz[c]));
+				__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(w[0], w[1]), rg[c]),
+					_mm_madd_epi16(_mm_unpackhi_epi16(w[2], zero), bz[c]));
+				half[h] = _mm_packs_epi32(_mm_srai_epi32(lo, 15), _mm_srai_epi32(hi, 15));
+			}
+			plane[c] = _mm_packus_epi16(half[0], half[1]);
+		}
+		mergePixels(bytes, plane);
+	}
+	sepiaSpan(p + k, n - k, type);
+}
+#endif
+
+/**
+ * Sepia Span For function
+ * the sepia span for the SIMD level
+ */
+SpanFn sepiaSpanFor() {
+#ifdef HAVE_X86_SIMD
+	if (simdLevel() >= 1) { return sepiaSpanSSSE3; }
+#endif
+	return sepiaSpan;
+}
+
+/**
+ * Sepia Filter function
+ * applies a sepia filter to the image
+ *
+ * @param img - the image to work with
+ */
+void changeSepia(Image &img) {
+	forEachSpan(img, sepiaSpanFor(), 0);
+}
+
+/**
+ * Swap Span function
+ * the per pixel work of changeSwap() over n pixels
+ */
+void swapSpan(Pixel *p, int n, char type) {
+	int temp = 0;
+	for (int k = 0; k < n; k++) {
+		// self explanatory
+		temp = p[k].red;
+		p[k].red = p[k].green;
+		p[k].green = p[k].blue;
+		p[k].blue = temp;
+	}
+}
+
+/**
+ * Channel Swap Filter function
+ * swaps R->G, G->B, B->R
+ *
+ * @param img - the image to work with
+ */
+void changeSwap(Image &img) {
+	forEachSpan(img, swapSpan, 0);
+}
+
+/**
+ * Single Channel Span function
+ * the per pixel work of changeSingleChannel() over n pixels,
+ * testing the channel on every pixel. Kept as the baseline for
+ * singleChannelSpanFixed() in --bench-specialized
+ */
+void singleChannelSpan(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		if (type == 'R') { // if red
+			p[k].green = 0; // set G = 0
+			p[k].blue = 0; // B = 0
+		}
+		else if (type == 'G') { // if green
+			p[k].red = 0;
+			p[k].blue = 0;
+		}
+		else { // else blue
+			p[k].red = 0;
+			p[k].green = 0;
+		}
+	}
+}
+
+/**
+ * Channel Index function
+ * 0, 1 or 2 for an R, G or B type, the index into a Pixel's bytes
+ */
+inline int channelIndex(char type) {
+	return (type == 'R') ? 0 : (type == 'G') ? 1 : 2;
+}
+
+/**
+ * Single Channel Span Fixed function
+ * singleChannelSpan() for one kept channel C, fixed at compile time:
+ * the other two bytes of every pixel are cleared with no tests
+ */
+template <int C>
+void singleChannelSpanFixed(Pixel *p, int n, char type) {
+	GLubyte *bytes = (GLubyte*)p;
+	for (int k = 0; k < n; k++) {
+		bytes[3 * k + (C + 1) % 3] = 0;
+		bytes[3 * k + (C + 2) % 3] = 0;
+	}
+}
+
+/**
+ * Single Channel Span For function
+ * the specialized span for a type, looked up once per call
+ */
+SpanFn singleChannelSpanFor(char type) {
+	static const SpanFn spans[3] = { singleChannelSpanFixed<0>, singleChannelSpanFixed<1>, singleChannelSpanFixed<2> };
+	return spans[channelIndex(type)];
+}
+
+/**
+ * Single Channel Filter function
+ * changes image color channels to singular
+ *
+ * @param img - the image to work with
+ * @param type - the type of channel to filter
+ */
+void changeSingleChannel(Image &img, char type) {
+	forEachSpan(img, singleChannelSpanFor(type), type);
+}
+
+/**
+ * Morph Row function
+ * van Herk/Gil-Werman running maximum or minimum over a window of
+ * 2r+1 pixels along a row, in place, every channel at once.
+ * The row is padded by r identity pixels either side, so windows
+ * are clipped at the ends. Each block of 2r+1 padded pixels gets
+ * a running extreme from its start (g) and from its end (h), and
+ * any window is then just one g against one h: three comparisons
+ * per channel whatever the radius
+ *
+ * @param row - the row, channels bytes per pixel (3 interleaved, 1 for a plane)
+ * @param n - pixels in the row
+ * @param r - the radius
+ * @param g - scratch, channels*(n+2r) bytes
+ * @param h - scratch, channels*(n+2r) bytes
+ */
+template <bool takeMax, int channels>
+void morphRow(GLubyte *row, int n, int r, GLubyte *g, GLubyte *h) {
+	const int bytes = (n + 2 * r) * channels, block = (2 * r + 1) * channels;
+	const GLubyte ident = takeMax ? 0 : 255;
+	memset(g, ident, r * channels);
+	memcpy(g + r * channels, row, n * channels);
+	memset(g + (n + r) * channels, ident, r * channels);
+	memcpy(h, g, bytes);
+	// block by block, so the inner loops have no tests but their own
+	for (int q = 0; q < bytes; q += block) {
+		int last = min(q + block, bytes);
+		for (int b = q + channels; b < last; b++) {
+			g[b] = takeMax ? max(g[b - channels], g[b]) : min(g[b - channels], g[b]);
+		}
+		for (int b = last - 1 - channels; b >= q; b--) {
+			h[b] = takeMax ? max(h[b + channels], h[b]) : min(h[b + channels], h[b]);
+		}
+	}
+	// the window of pixel i is padded [i, i+2r]
+	for (int b = 0; b < n * channels; b++) {
+		GLubyte a = h[b], z = g[b + block - channels];
+		row[b] = takeMax ? max(a, z) : min(a, z);
+	}
+}
+
+/**
+ * Morph Columns function
+ * the same running extreme down the columns of a strip of bytes.
+ * Whole row segments are combined at a time, so the inner loops
+ * run over contiguous memory
+ *
+ * @param base - first byte of the strip in the top row, already
+ *  filtered along its rows
+ * @param height - rows in the strip
+ * @param pitch - bytes from one row to the next
+ * @param bytes - width of the strip in bytes
+ * @param r - the radius
+ * @param g - scratch, bytes*(height+2r) bytes
+ * @param h - scratch, bytes*(height+2r) bytes
+ */
+template <bool takeMax>
+void morphColumns(GLubyte *base, int height, size_t pitch, int bytes, int r, GLubyte *g, GLubyte *h) {
+	const int k = 2 * r + 1, padded = height + 2 * r;
+	const GLubyte ident = takeMax ? 0 : 255;
+	for (int p = 0; p < padded; p++) {
+		GLubyte *gp = g + (size_t)p * bytes;
+		if (p < r || p >= height + r) { // padding carries the extreme on
+			if (p % k == 0) { memset(gp, ident, bytes); }
+			else { memcpy(gp, gp - bytes, bytes); }
+			continue;
+		}
+		const GLubyte *x = base + (p - r) * pitch;
+		if (p % k == 0) {
+			memcpy(gp, x, bytes);
+			continue;
+		}
+		for (int b = 0; b < bytes; b++) {
+			gp[b] = takeMax ? max(gp[b - bytes], x[b]) : min(gp[b - bytes], x[b]);
+		}
+	}
+	for (int p = padded - 1; p >= 0; p--) {
+		GLubyte *hp = h + (size_t)p * bytes;
+		if (p < r || p >= height + r) {
+			if (p % k == k - 1 || p == padded - 1) { memset(hp, ident, bytes); }
+			else { memcpy(hp, hp + bytes, bytes); }
+			continue;
+		}
+		const GLubyte *x = base + (p - r) * pitch;
+		if (p % k == k - 1 || p == padded - 1) {
+			memcpy(hp, x, bytes);
+			continue;
+		}
+		for (int b = 0; b < bytes; b++) {
+			hp[b] = takeMax ? max(hp[b + bytes], x[b]) : min(hp[b + bytes], x[b]);
+		}
+	}
+	for (int i = 0; i < height; i++) {
+		GLubyte *out = base + i * pitch;
+		const GLubyte *hp = h + (size_t)i * bytes, *gp = g + (size_t)(i + k - 1) * bytes;
+		for (int b = 0; b < bytes; b++) {
+			out[b] = takeMax ? max(hp[b], gp[b]) : min(hp[b], gp[b]);
+		}
+	}
+}
+
+// bytes per column strip in the vertical morphology pass
+#define MORPH_STRIP 768
+
+/**
+ * Morphology Filter function
+ * dilates (maximum) or erodes (minimum) with a square window of
+ * 2r+1 pixels, as a row pass then a column pass. Neighbours that
+ * fall off the image are left out, and the cost per pixel is the
+ * same for every radius
+ *
+ * @param img - the image to work with
+ * @param radius - window radius, 1 for the classic 3x3
+ * @param takeMax - dilate if true, erode otherwise
+ */
+void changeMorph(Image &img, int radius, bool takeMax) {
+	if (radius <= 0) { return; }
+	int w = img.width, h = img.height, r = radius;
+	parallelRows(h, w, [&](int begin, int end) {
+		size_t scratch = (size_t)3 * (w + 2 * r);
+		GLubyte *g = (GLubyte*)threadScratch(0, scratch), *hs = (GLubyte*)threadScratch(1, scratch);
+		for (int i = begin; i < end; i++) {
+			GLubyte *row = (GLubyte*)(img.data + (size_t)i*w);
+			if (takeMax) { morphRow<true, 3>(row, w, r, g, hs); }
+			else { morphRow<false, 3>(row, w, r, g, hs); }
+		}
+	});
+	int strips = (w * 3 + MORPH_STRIP - 1) / MORPH_STRIP;
+	parallelRows(strips, h * MORPH_STRIP / 3, [&](int begin, int end) {
+		size_t scratch = (size_t)MORPH_STRIP * (h + 2 * r);
+		GLubyte *g = (GLubyte*)threadScratch(0, scratch), *hs = (GLubyte*)threadScratch(1, scratch);
+		for (int s = begin; s < end; s++) {
+			int first = s * MORPH_STRIP, bytes = min(MORPH_STRIP, w * 3 - first);
+			GLubyte *base = (GLubyte*)img.data + first;
+			if (takeMax) { morphColumns<true>(base, h, (size_t)w * 3, bytes, r, g, hs); }
+			else { morphColumns<false>(base, h, (size_t)w * 3, bytes, r, g, hs); }
+		}
+	});
+}
+
+/**
+ * Maximize Filter function
+ * replaces RGB channels with maximum channel intensity
+ * of the surrounding (2r+1)x(2r+1) pixels
+ *
+ * @param img - the image to work with
+ * @param radius - the window radius
+ */
+void changeMax(Image &img, int radius) {
+	changeMorph(img, radius, true);
+}
+
+/**
+ * Minimize Filter function
+ * see Max Filter function, it's the exact same
+ * but min() instead of max() used
+ *
+ * @param img - the image to work with
+ * @param radius - the window radius
+ */
+void changeMin(Image &img, int radius) {
+	changeMorph(img, radius, false);
+}
+
+// window radius of the box blur and median filters (--smooth-radius)
+int smoothRadius = 3;
+
+/**
+ * Box Row function
+ * one output row of the box blur from the column sums of the rows
+ * in its window, with a running sum per channel along the row.
+ * Columns that fall off the image are left out, so each pixel is
+ * the truncated mean of the part of its window inside the image
+ *
+ * @param out - the row to write
+ * @param column - per byte sums of the rows in the window
+ * @param w - pixels in the row
+ * @param r - the radius
+ * @param rows - rows in the window
+ * @param inverse - 1/n for n up to 2r+1 columns
+ */
+void boxRow(GLubyte *out, const uint32_t *column, int w, int r, int rows, const double *inverse) {
+	uint64_t sum[3] = { 0, 0, 0 };
+	for (int x = 0; x <= min(r, w - 1); x++) {
+		for (int c = 0; c < 3; c++) { sum[c] += column[3 * x + c]; }
+	}
+	double perRow = 1.0 / rows;
+	for (int j = 0; j < w; j++) {
+		// + 0.5 keeps exact multiples from rounding below the whole number
+		double scale = inverse[min(w - 1, j + r) - max(0, j - r) + 1] * perRow;
+		for (int c = 0; c < 3; c++) { out[3 * j + c] = (GLubyte)((sum[c] + 0.5) * scale); }
+		if (j + r + 1 < w) {
+			for (int c = 0; c < 3; c++) { sum[c] += column[3 * (j + r + 1) + c]; }
+		}
+		if (j - r >= 0) {
+			for (int c = 0; c < 3; c++) { sum[c] -= column[3 * (j - r) + c]; }
+		}
+	}
+}
+
+/**
+ * Box Blur Filter function
+ * the mean of a square window of 2r+1 pixels, for any radius at
+ * the same cost per pixel: each band of rows keeps running column
+ * sums, adding the row entering the window and taking away the one
+ * leaving it, and every output row is a running sum along those.
+ * Radius 1 is exactly the 3x3 blur
+ *
+ * @param img - the image to work with
+ * @param radius - window radius
+ */
+void changeBoxBlur(Image &img, int radius) {
+	if (radius <= 0) { return; }
+	int w = img.width, h = img.height, r = min(radius, max(w, h)); // wider windows clip to the same pixels
+	Image src = scratchCopy(img);
+	parallelRows(h, w, [&](int begin, int end) {
+		uint32_t *column = (uint32_t*)threadScratch(0, sizeof(uint32_t) * 3 * w);
+		double *inverse = (double*)threadScratch(1, sizeof(double) * (2 * r + 2));
+		for (int n = 1; n <= 2 * r + 1; n++) { inverse[n] = 1.0 / n; }
+		memset(column, 0, sizeof(uint32_t) * 3 * w);
+		auto addRow = [&](int y, int sign) {
+			const GLubyte *row = (const GLubyte*)(src.data + (size_t)y * w);
+			for (int b = 0; b < 3 * w; b++) { column[b] += sign * row[b]; }
+		};
+		for (int y = max(0, begin - r); y <= min(h - 1, begin + r); y++) { addRow(y, 1); }
+		for (int i = begin; i < end; i++) {
+			int rows = min(h - 1, i + r) - max(0, i - r) + 1;
+			boxRow((GLubyte*)(img.data + (size_t)i * w), column, w, r, rows, inverse);
+			if (i - r >= 0) { addRow(i - r, -1); }
+			if (i + r + 1 < h) { addRow(i + r + 1, 1); }
+		}
+	});
+	releaseScratch(src);
+}
+
+// output columns per strip of the median filter
+#define MEDIAN_STRIP 256
+
+/**
+ * Median Strip function
+ * Perreault and Hebert's constant time median over one channel of
+ * a strip of columns. Every column in reach of the strip keeps a
+ * histogram of the rows in the window, in 16 coarse bins over 256
+ * fine ones, updated by one pixel out and one in per row. Along a
+ * row the window's coarse histogram adds one column and drops
+ * another per pixel; the median's coarse bin is found from that,
+ * and only that bin's 16 fine counts are brought up to date, from
+ * where it was last used or from scratch if that is further away
+ * than the window is wide. Off the image pixels are left out, and
+ * for an even count the lower of the middle two is taken
+ *
+ * @param src - unmodified copy of the image
+ * @param img - the image to write
+ * @param c - the channel
+ * @param x0 - first output column
+ * @param x1 - one past the last output column
+ * @param r - the radius
+ */
+void medianStrip(const Image &src, Image &img, int c, int x0, int x1, int r) {
+	int w = img.width, h = img.height;
+	int c0 = max(0, x0 - r), n = min(w, x1 + r) - c0; // histogram columns
+	uint16_t *fine = (uint16_t*)threadScratch(0, sizeof(uint16_t) * 256 * n);
+	uint16_t *coarse = (uint16_t*)threadScratch(1, sizeof(uint16_t) * 16 * n);
+	memset(fine, 0, sizeof(uint16_t) * 256 * n);
+	memset(coarse, 0, sizeof(uint16_t) * 16 * n);
+	const GLubyte *in = (const GLubyte*)src.data + c;
+	auto addRow = [&](int y, int sign) {
+		const GLubyte *row = in + ((size_t)y * w + c0) * 3;
+		for (int x = 0; x < n; x++) {
+			GLubyte v = row[3 * x];
+			fine[256 * x + v] += sign;
+			coarse[16 * x + (v >> 4)] += sign;
+		}
+	};
+	for (int y = 0; y <= min(h - 1, r); y++) { addRow(y, 1); }
+	for (int i = 0; i < h; i++) {
+		if (i - r - 1 >= 0) { addRow(i - r - 1, -1); }
+		if (i > 0 && i + r < h) { addRow(i + r, 1); }
+		int rows = min(h - 1, i + r) - max(0, i - r) + 1;
+		uint32_t kernelCoarse[16] = { 0 }, kernelFine[256];
+		int fresh[16]; // output column each fine bin was last brought up to
+		for (int b = 0; b < 16; b++) { fresh[b] = x0 - 2 * r - 2; } // stale
+		for (int x = max(0, x0 - r); x <= min(w - 1, x0 + r); x++) {
+			for (int b = 0; b < 16; b++) { kernelCoarse[b] += coarse[16 * (x - c0) + b]; }
+		}
+		GLubyte *out = (GLubyte*)(img.data + (size_t)i * w) + c;
+		for (int x = x0; x < x1; x++) {
+			int cols = min(w - 1, x + r) - max(0, x - r) + 1;
+			uint32_t rank = ((uint32_t)rows * cols - 1) / 2, below = 0;
+			int b = 0;
+			while (below + kernelCoarse[b] <= rank) { below += kernelCoarse[b++]; }
+			uint32_t *bin = kernelFine + 16 * b;
+			if (x - fresh[b] > 2 * r + 1) { // rebuild
+				memset(bin, 0, sizeof(uint32_t) * 16);
+				for (int col = max(0, x - r); col <= min(w - 1, x + r); col++) {
+					const uint16_t *f = fine + 256 * (col - c0) + 16 * b;
+					for (int v = 0; v < 16; v++) { bin[v] += f[v]; }
+				}
+			}
+			else {
+				for (int at = fresh[b] + 1; at <= x; at++) { // slide
+					if (at + r < w) {
+						const uint16_t *f = fine + 256 * (at + r - c0) + 16 * b;
+						for (int v = 0; v < 16; v++) { bin[v] += f[v]; }
+					}
+					if (at - r - 1 >= 0) {
+						const uint16_t *f = fine + 256 * (at - r - 1 - c0) + 16 * b;
+						for (int v = 0; v < 16; v++) { bin[v] -= f[v]; }
+					}
+				}
+			}
+			fresh[b] = x;
+			int v = 0;
+			while (below + bin[v] <= rank) { below += bin[v++]; }
+			out[3 * x] = 16 * b + v;
+			if (x + 1 + r < w) {
+				for (int k = 0; k < 16; k++) { kernelCoarse[k] += coarse[16 * (x + 1 + r - c0) + k]; }
+			}
+			if (x - r >= 0) {
+				for (int k = 0; k < 16; k++) { kernelCoarse[k] -= coarse[16 * (x - r - c0) + k]; }
+			}
+		}
+	}
+}
+
+/**
+ * Median Filter function
+ * replaces every channel with its median over a square window of
+ * 2r+1 pixels, at the same cost per pixel for any radius. Strips
+ * of columns run in parallel, one channel at a time
+ *
+ * @param img - the image to work with
+ * @param radius - window radius
+ */
+void changeMedian(Image &img, int radius) {
+	if (radius <= 0) { return; }
+	// wider windows clip to the same pixels, and column counts fit 16 bits
+	int w = img.width, h = img.height, r = min(radius, min(max(w, h), 32767));
+	int strips = (w + MEDIAN_STRIP - 1) / MEDIAN_STRIP;
+	Image src = scratchCopy(img);
+	parallelRows(3 * strips, h * MEDIAN_STRIP, [&](int begin, int end) {
+		for (int s = begin; s < end; s++) {
+			int x0 = (s % strips) * MEDIAN_STRIP;
+			medianStrip(src, img, s / strips, x0, min(w, x0 + MEDIAN_STRIP), r);
+		}
+	});
+	releaseScratch(src);
+}
+
+/**
+ * Intensity Span function
+ * the per pixel work of changeIntensity() over n pixels, testing
+ * the channel and multiplying in doubles on every pixel. Kept as
+ * the baseline for intensitySpanFixed() in --bench-specialized
+ */
+void intensitySpan(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		/**
+		 * depending on type, change color channel
+		 * intensity by 15% each time the
+		 * algorithm is run
+		 */
+		if (type == 'R') {
+			p[k].red = min(255, p[k].red*1.15);
+		}
+		else if (type == 'G') {
+			p[k].green = min(255, p[k].green * 1.15);
+		}
+		else {
+			p[k].blue = min(255, p[k].blue * 1.15);
+		}
+	}
+}
+
+/**
+ * Intensity Table
+ * the 15% boost for every byte, worked out at compile time with
+ * the same double expression as intensitySpan() so looking a byte
+ * up gives exactly what multiplying it would
+ */
+typedef struct {
+	GLubyte level[256];
+} IntensityTable;
+
+constexpr IntensityTable intensityTable = []() {
+	IntensityTable t = {};
+	for (int v = 0; v < 256; v++) { t.level[v] = (GLubyte)min(255, v * 1.15); }
+	return t;
+}();
+
+/**
+ * Intensity Span Fixed function
+ * intensitySpan() for one channel C fixed at compile time, a
+ * strided table lookup over that channel's bytes alone
+ */
+template <int C>
+void intensitySpanFixed(Pixel *p, int n, char type) {
+	GLubyte *bytes = (GLubyte*)p + C;
+	const GLubyte *level = intensityTable.level;
+	for (int k = 0; k < n; k++) {
+		bytes[3 * k] = level[bytes[3 * k]];
+	}
+}
+
+/**
+ * Intensity Span For function
+ * the specialized span for a type, looked up once per call
+ */
+SpanFn intensitySpanFor(char type) {
+	static const SpanFn spans[3] = { intensitySpanFixed<0>, intensitySpanFixed<1>, intensitySpanFixed<2> };
+	return spans[channelIndex(type)];
+}
+
+/**
+ * Intensity Filter function
+ * increase intensity of certain color channels
+ *
+ * @param img - the image to work with
+ * @param type - the color channel to intensify
+ */
+void changeIntensity(Image &img, char type) {
+	forEachSpan(img, intensitySpanFor(type), type);
+}
+
+/**
+ * Sobel Row function
+ * gradient magnitude of one row of one channel. Gx and Gy come
+ * out of the same pass over the three source rows, and the edges
+ * of the image repeat their outermost pixel
+ *
+ * @param out - first output byte of the row
+ * @param outStride - bytes between output pixels
+ * @param rows - the rows above, at and below, clamped at the edges
+ * @param stride - bytes between input pixels
+ * @param width - pixels in the row
+ * @param norm - '1' for |Gx| + |Gy|, '2' for sqrt(Gx^2 + Gy^2)
+ */
+void sobelRow(GLubyte *out, int outStride, const GLubyte **rows, int stride, int width, char norm) {
+	const GLubyte *a = rows[0], *m = rows[1], *b = rows[2];
+	for (int j = 0; j < width; j++, out += outStride) {
+		int l = max(j - 1, 0) * stride, c = j * stride, r = min(j + 1, width - 1) * stride;
+		int gx = (a[r] + 2 * m[r] + b[r]) - (a[l] + 2 * m[l] + b[l]);
+		int gy = (b[l] + 2 * b[c] + b[r]) - (a[l] + 2 * a[c] + a[r]);
+		int mag = (norm == '1') ? abs(gx) + abs(gy) : (int)(sqrtf((float)(gx*gx + gy*gy)) + 0.5f);
+		*out = min(255, mag);
+	}
+}
+
+/**
+ * Sobel Filter function
+ * single pass Sobel edge detection writing the gradient magnitude.
+ * In greyscale mode the luminance is taken on the way in, into a
+ * one byte per pixel plane, instead of as a separate filter
+ *
+ * @param img - the image to work with
+ * @param norm - '1' for the L1 magnitude, '2' for L2
+ * @param grey - whether to detect edges on the luminance
+ */
+void changeSobel(Image &img, char norm, bool grey) {
+	int w = img.width, h = img.height;
+	if (grey) {
+		GLubyte *plane = (GLubyte*)acquireBuffer((size_t)w*h);
+		parallelRows(h, w, [&](int begin, int end) {
+			for (size_t k = (size_t)begin*w; k < (size_t)end*w; k++) {
+				plane[k] = luminance(img.data[k], 0.33, 0.33, 0.33);
+			}
+		});
+		parallelRows(h, w, [&](int begin, int end) {
+			for (int i = begin; i < end; i++) {
+				const GLubyte *rows[3] = { plane + (size_t)max(i - 1, 0)*w,
+					plane + (size_t)i*w, plane + (size_t)min(i + 1, h - 1)*w };
+				GLubyte *out = (GLubyte*)(img.data + (size_t)i*w);
+				sobelRow(out, 3, rows, 1, w, norm);
+				for (int j = 0; j < w; j++) { // grey goes to every channel
+					out[3 * j + 1] = out[3 * j + 2] = out[3 * j];
+				}
+			}
+		});
+		releaseBuffer(plane);
+		return;
+	}
+	Image src = scratchCopy(img);
+	parallelRows(h, w, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			GLubyte *out = (GLubyte*)(img.data + (size_t)i*w);
+			for (int c = 0; c < 3; c++) { // channel by channel
+				const GLubyte *rows[3] = { (const GLubyte*)(src.data + (size_t)max(i - 1, 0)*w) + c,
+					(const GLubyte*)(src.data + (size_t)i*w) + c,
+					(const GLubyte*)(src.data + (size_t)min(i + 1, h - 1)*w) + c };
+				sobelRow(out + c, 3, rows, 3, w, norm);
+			}
+		}
+	});
+	releaseScratch(src);
+}
+
+/**
+ * Edge Detection function
+ * performs both Sobel operations on
+ * the image, with a color variant as bonus
+ *
+ * @param img - the image to work with
+ * @param colorToggle - whether or not you need color
+ */
+void bothEdges(Image &img, char colorToggle) {
+	changeSobel(img, edgeNorm, colorToggle != 'C');
+}
+
+/**
+ * Convolution Plan
+ * everything about a 3x3 kernel that can be worked out once per
+ * call instead of once per pixel: its divisor and how to apply it
+ * without a divide, whether it splits into two 1D passes, and its
+ * non-zero taps
+ */
+typedef struct {
+	const int *matrix; // the kernel, row by row
+	int divisor; // interior divisor, the clamped sum of the taps
+	char divide; // '1' none, 'S' shift, 'M' reciprocal multiply
+	int shift, reciprocal;
+	bool simd; // sums fit in 16 bits and divide is '1', 'S' or 'M'
+	bool separable; // matrix is vertical x horizontal
+	int vertical[3], horizontal[3];
+	int taps; // non-zero taps, as row, byte offset and weight
+	int tapRow[9], tapOffset[9], tapWeight[9];
+	int step; // bytes from one pixel to the next: 3 interleaved, 1 in a plane
+} ConvPlan;
+
+/**
+ * Interior row kernels get the rows above, at and below the one
+ * being written, each pointing at the second pixel, and compute
+ * `bytes` output bytes with no bounds checks at all
+ */
+typedef void(*ConvRowFn)(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan);
+
+/**
+ * Plan Convolution function
+ * fills in a plan for a 3x3 kernel
+ *
+ * @param plan - the plan to fill
+ * @param matrix - the kernel, row by row
+ * @param step - bytes between neighbouring pixels, 1 for planes
+ */
+void planConvolution(ConvPlan &plan, const int *matrix, int step = 3) {
+	int sum = 0, magnitude = 0;
+	plan.matrix = matrix;
+	plan.step = step;
+	plan.taps = 0;
+	for (int t = 0; t < 9; t++) {
+		sum += matrix[t];
+		magnitude += abs(matrix[t]);
+		if (matrix[t] != 0) {
+			plan.tapRow[plan.taps] = t / 3;
+			plan.tapOffset[plan.taps] = (t % 3 - 1) * step;
+			plan.tapWeight[plan.taps++] = matrix[t];
+		}
+	}
+	plan.divisor = max(sum, 1);
+	// every partial sum stays within 255 * sum of |taps|
+	plan.simd = 255 * magnitude <= 32767;
+	plan.divide = '1';
+	plan.shift = plan.reciprocal = 0;
+	if (plan.divisor > 1 && (plan.divisor & (plan.divisor - 1)) == 0) {
+		plan.divide = 'S';
+		while ((1 << plan.shift) < plan.divisor) { plan.shift++; }
+	}
+	else if (plan.divisor > 1) {
+		/**
+		 * negative sums clamp to 0 whichever way they're rounded,
+		 * so the reciprocal only has to be exact for the positive
+		 * sums this kernel can actually produce
+		 */
+		plan.divide = 'M';
+		plan.reciprocal = (65536 + plan.divisor - 1) / plan.divisor;
+		if (plan.reciprocal > 32767) { plan.simd = false; }
+		for (int x = 0; plan.simd && x <= 255 * magnitude; x++) {
+			if (((x * plan.reciprocal) >> 16) != x / plan.divisor) { plan.simd = false; }
+		}
+	}
+	// separable if every row is a whole multiple of one base row
+	plan.separable = false;
+	int base = -1;
+	for (int r = 0; r < 3 && base < 0; r++) {
+		if (matrix[r * 3] || matrix[r * 3 + 1] || matrix[r * 3 + 2]) { base = r; }
+	}
+	if (base < 0) { return; }
+	int g = 0; // reduce the base row by its gcd
+	for (int c = 0; c < 3; c++) {
+		int a = abs(matrix[base * 3 + c]), b = g;
+		while (b != 0) {
+			int t = a % b;
+			a = b;
+			b = t;
+		}
+		g = a;
+	}
+	int pivot = 0;
+	for (int c = 0; c < 3; c++) {
+		plan.horizontal[c] = matrix[base * 3 + c] / g;
+		if (plan.horizontal[c] != 0) { pivot = c; }
+	}
+	plan.separable = true;
+	for (int r = 0; r < 3; r++) {
+		plan.vertical[r] = matrix[r * 3 + pivot] / plan.horizontal[pivot];
+		for (int c = 0; c < 3; c++) {
+			if (plan.vertical[r] * plan.horizontal[c] != matrix[r * 3 + c]) { plan.separable = false; }
+		}
+	}
+}
+
+/**
+ * Divide Sum function
+ * the scalar form of a plan's divide and the 0-255 clamp
+ */
+inline GLubyte divideSum(int sum, const ConvPlan &plan) {
+	return max(0, min(255, sum / plan.divisor));
+}
+
+/**
+ * Interior Row kernels
+ * the plain C version, also the reference for the SIMD ones
+ */
+void convolveInteriorScalar(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan) {
+	for (int b = 0; b < bytes; b++) {
+		int sum = 0;
+		for (int t = 0; t < plan.taps; t++) {
+			sum += rows[plan.tapRow[t]][b + plan.tapOffset[t]] * plan.tapWeight[t];
+		}
+		out[b] = divideSum(sum, plan);
+	}
+}
+
+/**
+ * Separable Tail function
+ * finishes a separable row from its vertical sums in plain C,
+ * for the bytes left over after the vector loop
+ */
+void separableTail(GLubyte *out, const short *sums, int from, int bytes, const ConvPlan &plan) {
+	for (int b = from; b < bytes; b++) {
+		int sum = plan.horizontal[0] * sums[b - plan.step] + plan.horizontal[1] * sums[b]
+			+ plan.horizontal[2] * sums[b + plan.step];
+		out[b] = divideSum(sum, plan);
+	}
+}
+
+/**
+ * Vertical Tail function
+ * the plain C vertical pass for the bytes the vector loop left
+ */
+void verticalTail(short *sums, const GLubyte **rows, int from, int to, const ConvPlan &plan) {
+	for (int b = from; b < to; b++) {
+		sums[b] = plan.vertical[0] * rows[0][b] + plan.vertical[1] * rows[1][b]
+			+ plan.vertical[2] * rows[2][b];
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse4.1")))
+inline __m128i divideSSE41(__m128i x, const ConvPlan &plan) {
+	if (plan.divide == 'S') { return _mm_sra_epi16(x, _mm_cvtsi32_si128(plan.shift)); }
+	if (plan.divide == 'M') { return _mm_mulhi_epi16(x, _mm_set1_epi16(plan.reciprocal)); }
+	return x;
+}
+
+__attribute__((target("sse4.1")))
+inline __m128i loadBytesSSE41(const GLubyte *p) {
+	return _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)p));
+}
+
+__attribute__((target("sse4.1")))
+void convolveInteriorSSE41(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan) {
+	int b = 0;
+	if (plan.separable) {
+		// vertical pass over the row plus a pixel either side
+		short *sums = (short*)threadScratch(0, sizeof(short) * (bytes + 2 * plan.step)) + plan.step;
+		__m128i v0 = _mm_set1_epi16(plan.vertical[0]), v1 = _mm_set1_epi16(plan.vertical[1]),
+			v2 = _mm_set1_epi16(plan.vertical[2]);
+		for (b = -plan.step; b + 8 <= bytes + plan.step; b += 8) {
+			__m128i s = _mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(loadBytesSSE41(rows[0] + b), v0),
+				_mm_mullo_epi16(loadBytesSSE41(rows[1] + b), v1)),
+				_mm_mullo_epi16(loadBytesSSE41(rows[2] + b), v2));
+			_mm_storeu_si128((__m128i*)(sums + b), s);
+		}
+		verticalTail(sums, rows, b, bytes + plan.step, plan);
+		// then horizontal, neighbours are a pixel (plan.step bytes) away
+		__m128i h0 = _mm_set1_epi16(plan.horizontal[0]), h1 = _mm_set1_epi16(plan.horizontal[1]),
+			h2 = _mm_set1_epi16(plan.horizontal[2]);
+		for (b = 0; b + 8 <= bytes; b += 8) {
+			__m128i s = _mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(sums + b - plan.step)), h0),
+				_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(sums + b)), h1)),
+				_mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(sums + b + plan.step)), h2));
+			s = divideSSE41(s, plan);
+			_mm_storel_epi64((__m128i*)(out + b), _mm_packus_epi16(s, s));
+		}
+		separableTail(out, sums, b, bytes, plan);
+		return;
+	}
+	for (; b + 8 <= bytes; b += 8) {
+		__m128i s = _mm_setzero_si128();
+		for (int t = 0; t < plan.taps; t++) {
+			s = _mm_add_epi16(s, _mm_mullo_epi16(loadBytesSSE41(rows[plan.tapRow[t]] + b + plan.tapOffset[t]),
+				_mm_set1_epi16(plan.tapWeight[t])));
+		}
+		s = divideSSE41(s, plan);
+		_mm_storel_epi64((__m128i*)(out + b), _mm_packus_epi16(s, s));
+	}
+	const GLubyte *rest[3] = { rows[0] + b, rows[1] + b, rows[2] + b };
+	convolveInteriorScalar(out + b, rest, bytes - b, plan);
+}
+
+__attribute__((target("avx2")))
+inline __m256i divideAVX2(__m256i x, const ConvPlan &plan) {
+	if (plan.divide == 'S') { return _mm256_sra_epi16(x, _mm_cvtsi32_si128(plan.shift)); }
+	if (plan.divide == 'M') { return _mm256_mulhi_epi16(x, _mm256_set1_epi16(plan.reciprocal)); }
+	return x;
+}
+
+__attribute__((target("avx2")))
+inline __m256i loadBytesAVX2(const GLubyte *p) {
+	return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p));
+}
+
+__attribute__((target("avx2")))
+inline void storeBytesAVX2(GLubyte *p, __m256i x) {
+	// packus works within 128 bit lanes, so pack the two halves
+	_mm_storeu_si128((__m128i*)p, _mm_packus_epi16(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1)));
+}
+
+__attribute__((target("avx2")))
+void convolveInteriorAVX2(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan) {
+	int b = 0;
+	if (plan.separable) {
+		short *sums = (short*)threadScratch(0, sizeof(short) * (bytes + 2 * plan.step)) + plan.step;
+		__m256i v0 = _mm256_set1_epi16(plan.vertical[0]), v1 = _mm256_set1_epi16(plan.vertical[1]),
+			v2 = _mm256_set1_epi16(plan.vertical[2]);
+		for (b = -plan.step; b + 16 <= bytes + plan.step; b += 16) {
+			__m256i s = _mm256_add_epi16(_mm256_add_epi16(
+				_mm256_mullo_epi16(loadBytesAVX2(rows[0] + b), v0),
+				_mm256_mullo_epi16(loadBytesAVX2(rows[1] + b), v1)),
+				_mm256_mullo_epi16(loadBytesAVX2(rows[2] + b), v2));
+			_mm256_storeu_si256((__m256i*)(sums + b), s);
+		}
+		verticalTail(sums, rows, b, bytes + plan.step, plan);
+		__m256i h0 = _mm256_set1_epi16(plan.horizontal[0]), h1 = _mm256_set1_epi16(plan.horizontal[1]),
+			h2 = _mm256_set1_epi16(plan.horizontal[2]);
+		for (b = 0; b + 16 <= bytes; b += 16) {
+			__m256i s = _mm256_add_epi16(_mm256_add_epi16(
+				_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(sums + b - plan.step)), h0),
+				_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(sums + b)), h1)),
+				_mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(sums + b + plan.step)), h2));
+			storeBytesAVX2(out + b, divideAVX2(s, plan));
+		}
+		separableTail(out, sums, b, bytes, plan);
+		return;
+	}
+	for (; b + 16 <= bytes; b += 16) {
+		__m256i s = _mm256_setzero_si256();
+		for (int t = 0; t < plan.taps; t++) {
+			s = _mm256_add_epi16(s, _mm256_mullo_epi16(loadBytesAVX2(rows[plan.tapRow[t]] + b + plan.tapOffset[t]),
+				_mm256_set1_epi16(plan.tapWeight[t])));
+		}
+		storeBytesAVX2(out + b, divideAVX2(s, plan));
+	}
+	const GLubyte *rest[3] = { rows[0] + b, rows[1] + b, rows[2] + b };
+	convolveInteriorScalar(out + b, rest, bytes - b, plan);
+}
+#endif
+
+/**
+ * Interior Kernel function
+ * picks the interior row kernel for a plan on this CPU
+ *
+ * @param plan - the planned kernel
+ * @return - the row kernel to use
+ */
+ConvRowFn interiorKernel(const ConvPlan &plan) {
+#ifdef HAVE_X86_SIMD
+	if (plan.simd && simdLevel() >= 2) { return convolveInteriorAVX2; }
+	if (plan.simd && simdLevel() >= 1) { return convolveInteriorSSE41; }
+#endif
+	return convolveInteriorScalar;
+}
+
+/**
+ * Fixed Taps
+ * the built in 3x3 kernels as compile time constants, with their
+ * split into vertical x horizontal where they have one. Interior
+ * kernels specialized on an entry have every weight, the divisor
+ * and the pixel step folded in: zero taps vanish, weights of 1
+ * need no multiply and the tap loop unrolls
+ */
+typedef struct {
+	int matrix[9]; // row by row
+	bool separable;
+	int vertical[3], horizontal[3];
+	int divisor; // the sum of the taps, at least 1
+} FixedTaps;
+#define FIXED_SOBEL_H 0
+#define FIXED_SOBEL_V 1
+#define FIXED_BLUR 2
+#define FIXED_GAUSS 3
+#define FIXED_SHARPEN 4
+#define FIXED_COUNT 5
+constexpr FixedTaps fixedTaps[FIXED_COUNT] = {
+	{ { 1, 2, 1, 0, 0, 0, -1, -2, -1 }, true, { 1, 0, -1 }, { 1, 2, 1 }, 1 }, // Sobel H
+	{ { 1, 0, -1, 2, 0, -2, 1, 0, -1 }, true, { 1, 2, 1 }, { 1, 0, -1 }, 1 }, // Sobel V
+	{ { 1, 1, 1, 1, 1, 1, 1, 1, 1 }, true, { 1, 1, 1 }, { 1, 1, 1 }, 9 }, // Blur
+	{ { 1, 2, 1, 2, 4, 2, 1, 2, 1 }, true, { 1, 2, 1 }, { 1, 2, 1 }, 16 }, // Gauss. Blur
+	{ { 0, -1, 0, -1, 5, -1, 0, -1, 0 }, false, { 0, 0, 0 }, { 0, 0, 0 }, 1 } // Sharpen
+};
+
+/**
+ * Taps Agree function
+ * whether an entry's factors and divisor match its matrix, checked
+ * by the compiler below
+ */
+constexpr bool tapsAgree(const FixedTaps &t) {
+	int sum = 0;
+	for (int k = 0; k < 9; k++) {
+		sum += t.matrix[k];
+		if (t.separable && t.vertical[k / 3] * t.horizontal[k % 3] != t.matrix[k]) { return false; }
+	}
+	return t.divisor == (sum > 1 ? sum : 1);
+}
+static_assert(tapsAgree(fixedTaps[0]) && tapsAgree(fixedTaps[1]) && tapsAgree(fixedTaps[2])
+	&& tapsAgree(fixedTaps[3]) && tapsAgree(fixedTaps[4]), "fixed taps disagree with their matrices");
+
+/**
+ * Interior Row kernels, specialized
+ * convolveInterior*() for fixed taps M and pixel step S. The
+ * reciprocal used for divisors that aren't a power of two is the
+ * one planConvolution() checks, so the vector forms are only
+ * picked when plan.simd says it is exact
+ */
+template <int M, int S>
+void convolveFixedScalar(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan) {
+	constexpr FixedTaps T = fixedTaps[M];
+	for (int b = 0; b < bytes; b++) {
+		int sum = 0;
+#pragma GCC unroll 9
+		for (int t = 0; t < 9; t++) {
+			if (T.matrix[t] != 0) { sum += rows[t / 3][b + (t % 3 - 1) * S] * T.matrix[t]; }
+		}
+		out[b] = max(0, min(255, sum / T.divisor));
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+template <int M>
+constexpr int fixedShift() {
+	int shift = 0;
+	while ((1 << shift) < fixedTaps[M].divisor) { shift++; }
+	return ((1 << shift) == fixedTaps[M].divisor) ? shift : -1; // -1 when not a power of two
+}
+
+template <int M>
+__attribute__((target("sse4.1")))
+inline __m128i divideFixedSSE41(__m128i x) {
+	constexpr int d = fixedTaps[M].divisor, shift = fixedShift<M>();
+	if constexpr (d == 1) { return x; }
+	else if constexpr (shift > 0) { return _mm_srai_epi16(x, shift); }
+	else { return _mm_mulhi_epi16(x, _mm_set1_epi16((65536 + d - 1) / d)); }
+}
+
+template <int M, int S>
+__attribute__((target("sse4.1")))
+void convolveFixedSSE41(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan) {
+	constexpr FixedTaps T = fixedTaps[M];
+	int b = 0;
+	if constexpr (T.separable) {
+		short *sums = (short*)threadScratch(0, sizeof(short) * (bytes + 2 * S)) + S;
+		for (b = -S; b + 8 <= bytes + S; b += 8) {
+			__m128i s = _mm_setzero_si128();
+#pragma GCC unroll 3
+			for (int r = 0; r < 3; r++) {
+				if (T.vertical[r] != 0) {
+					s = _mm_add_epi16(s, _mm_mullo_epi16(loadBytesSSE41(rows[r] + b), _mm_set1_epi16(T.vertical[r])));
+				}
+			}
+			_mm_storeu_si128((__m128i*)(sums + b), s);
+		}
+		for (; b < bytes + S; b++) { sums[b] = T.vertical[0] * rows[0][b] + T.vertical[1] * rows[1][b] + T.vertical[2] * rows[2][b]; }
+		for (b = 0; b + 8 <= bytes; b += 8) {
+			__m128i s = _mm_setzero_si128();
+#pragma GCC unroll 3
+			for (int c = 0; c < 3; c++) {
+				if (T.horizontal[c] != 0) {
+					s = _mm_add_epi16(s, _mm_mullo_epi16(_mm_loadu_si128((const __m128i*)(sums + b + (c - 1) * S)),
+						_mm_set1_epi16(T.horizontal[c])));
+				}
+			}
+			s = divideFixedSSE41<M>(s);
+			_mm_storel_epi64((__m128i*)(out + b), _mm_packus_epi16(s, s));
+		}
+		for (; b < bytes; b++) {
+			int sum = T.horizontal[0] * sums[b - S] + T.horizontal[1] * sums[b] + T.horizontal[2] * sums[b + S];
+			out[b] = max(0, min(255, sum / T.divisor));
+		}
+		return;
+	}
+	for (; b + 8 <= bytes; b += 8) {
+		__m128i s = _mm_setzero_si128();
+#pragma GCC unroll 9
+		for (int t = 0; t < 9; t++) {
+			if (T.matrix[t] != 0) {
+				s = _mm_add_epi16(s, _mm_mullo_epi16(loadBytesSSE41(rows[t / 3] + b + (t % 3 - 1) * S),
+					_mm_set1_epi16(T.matrix[t])));
+			}
+		}
+		s = divideFixedSSE41<M>(s);
+		_mm_storel_epi64((__m128i*)(out + b), _mm_packus_epi16(s, s));
+	}
+	const GLubyte *rest[3] = { rows[0] + b, rows[1] + b, rows[2] + b };
+	convolveFixedScalar<M, S>(out + b, rest, bytes - b, plan);
+}
+
+template <int M>
+__attribute__((target("avx2")))
+inline __m256i divideFixedAVX2(__m256i x) {
+	constexpr int d = fixedTaps[M].divisor, shift = fixedShift<M>();
+	if constexpr (d == 1) { return x; }
+	else if constexpr (shift > 0) { return _mm256_srai_epi16(x, shift); }
+	else { return _mm256_mulhi_epi16(x, _mm256_set1_epi16((65536 + d - 1) / d)); }
+}
+
+template <int M, int S>
+__attribute__((target("avx2")))
+void convolveFixedAVX2(GLubyte *out, const GLubyte **rows, int bytes, const ConvPlan &plan) {
+	constexpr FixedTaps T = fixedTaps[M];
+	int b = 0;
+	if constexpr (T.separable) {
+		short *sums = (short*)threadScratch(0, sizeof(short) * (bytes + 2 * S)) + S;
+		for (b = -S; b + 16 <= bytes + S; b += 16) {
+			__m256i s = _mm256_setzero_si256();
+#pragma GCC unroll 3
+			for (int r = 0; r < 3; r++) {
+				if (T.vertical[r] != 0) {
+					s = _mm256_add_epi16(s, _mm256_mullo_epi16(loadBytesAVX2(rows[r] + b), _mm256_set1_epi16(T.vertical[r])));
+				}
+			}
+			_mm256_storeu_si256((__m256i*)(sums + b), s);
+		}
+		for (; b < bytes + S; b++) { sums[b] = T.vertical[0] * rows[0][b] + T.vertical[1] * rows[1][b] + T.vertical[2] * rows[2][b]; }
+		for (b = 0; b + 16 <= bytes; b += 16) {
+			__m256i s = _mm256_setzero_si256();
+#pragma GCC unroll 3
+			for (int c = 0; c < 3; c++) {
+				if (T.horizontal[c] != 0) {
+					s = _mm256_add_epi16(s, _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i*)(sums + b + (c - 1) * S)),
+						_mm256_set1_epi16(T.horizontal[c])));
+				}
+			}
+			storeBytesAVX2(out + b, divideFixedAVX2<M>(s));
+		}
+		for (; b < bytes; b++) {
+			int sum = T.horizontal[0] * sums[b - S] + T.horizontal[1] * sums[b] + T.horizontal[2] * sums[b + S];
+			out[b] = max(0, min(255, sum / T.divisor));
+		}
+		return;
+	}
+	for (; b + 16 <= bytes; b += 16) {
+		__m256i s = _mm256_setzero_si256();
+#pragma GCC unroll 9
+		for (int t = 0; t < 9; t++) {
+			if (T.matrix[t] != 0) {
+				s = _mm256_add_epi16(s, _mm256_mullo_epi16(loadBytesAVX2(rows[t / 3] + b + (t % 3 - 1) * S),
+					_mm256_set1_epi16(T.matrix[t])));
+			}
+		}
+		storeBytesAVX2(out + b, divideFixedAVX2<M>(s));
+	}
+	const GLubyte *rest[3] = { rows[0] + b, rows[1] + b, rows[2] + b };
+	convolveFixedScalar<M, S>(out + b, rest, bytes - b, plan);
+}
+#define FIXED_LEVELS(M, S) { convolveFixedScalar<M, S>, convolveFixedSSE41<M, S>, convolveFixedAVX2<M, S> }
+#else
+#define FIXED_LEVELS(M, S) { convolveFixedScalar<M, S>, convolveFixedScalar<M, S>, convolveFixedScalar<M, S> }
+#endif
+#define FIXED_STEPS(M) { FIXED_LEVELS(M, 3), FIXED_LEVELS(M, 1) }
+
+/**
+ * Fixed Kernel function
+ * the specialized interior row kernel for built in kernel m on
+ * this CPU, looked up once per call
+ *
+ * @param m - the fixedTaps entry
+ * @param plan - its plan, whose step picks interleaved or planar
+ * @return - the row kernel to use
+ */
+ConvRowFn fixedKernel(int m, const ConvPlan &plan) {
+	static const ConvRowFn kernels[FIXED_COUNT][2][3] = {
+		FIXED_STEPS(0), FIXED_STEPS(1), FIXED_STEPS(2), FIXED_STEPS(3), FIXED_STEPS(4)
+	};
+	return kernels[m][plan.step == 1][plan.simd ? simdLevel() : 0];
+}
+
+/**
+ * Convolve Pixel function
+ * applies a 3x3 kernel to one pixel. Taps that fall off the
+ * image are left out of both the sum and the divisor
+ *
+ * @param src - unmodified copy of the image
+ * @param out - the pixel to write
+ * @param matrix - the kernel, row by row
+ * @param i - row of the pixel
+ * @param j - column of the pixel
+ */
+void convolvePixel(const Image &src, Pixel &out, const int *matrix, int i, int j) {
+	int l = 0; // to divide later
+	int rgbTemp[3] = { 0, 0, 0 };
+	for (int y = -1; y <= 1; y++) {
+		if (i + y < 0 || i + y >= src.height) { continue; }
+		const Pixel *row = src.data + (size_t)(i + y)*src.width;
+		for (int x = -1; x <= 1; x++) {
+			if (j + x < 0 || j + x >= src.width) { continue; }
+			int m = matrix[(y + 1) * 3 + x + 1];
+			l += m;
+			rgbTemp[0] += row[j + x].red*m;
+			rgbTemp[1] += row[j + x].green*m;
+			rgbTemp[2] += row[j + x].blue*m;
+		}
+	}
+	/**
+	 * we need to clamp down the bounds so you don't get
+	 * below or above RGB range. Additionally, clamp the divisor
+	 * for edge detection so we don't get division by zero
+	 */
+	out.red = max(0, min(255, rgbTemp[0] / max(l, 1)));
+	out.green = max(0, min(255, rgbTemp[1] / max(l, 1)));
+	out.blue = max(0, min(255, rgbTemp[2] / max(l, 1)));
+}
+
+/**
+ * Convolve Rows function
+ * applies a planned 3x3 kernel to rows [begin, end). The outer
+ * ring of pixels goes through convolvePixel, everything else
+ * through the branch free interior kernel
+ *
+ * @param src - unmodified copy of the image, supplies the halo
+ * @param dst - the image to write
+ * @param plan - the planned kernel
+ * @param interior - the interior row kernel
+ * @param begin - first row
+ * @param end - one past the last row
+ */
+void convolveRows(const Image &src, Image &dst, const ConvPlan &plan, ConvRowFn interior, int begin, int end) {
+	int w = src.width;
+	for (int i = begin; i < end; i++) {
+		Pixel *out = dst.data + (size_t)i*w;
+		if (i == 0 || i == src.height - 1 || w < 3) {
+			for (int j = 0; j < w; j++) {
+				convolvePixel(src, out[j], plan.matrix, i, j);
+			}
+			continue;
+		}
+		const GLubyte *rows[3] = {
+			(const GLubyte*)(src.data + (size_t)(i - 1)*w + 1),
+			(const GLubyte*)(src.data + (size_t)i*w + 1),
+			(const GLubyte*)(src.data + (size_t)(i + 1)*w + 1)
+		};
+		convolvePixel(src, out[0], plan.matrix, i, 0);
+		interior((GLubyte*)(out + 1), rows, (w - 2) * 3, plan);
+		convolvePixel(src, out[w - 1], plan.matrix, i, w - 1);
+	}
+}
+
+/**
+ * Convolution Index function
+ * the fixedTaps entry for a convolution type
+ *
+ * @param type - H/V Sobel, G Gaussian blur, S sharpen, else blur
+ * @return - the index
+ */
+int convolutionIndex(char type) {
+	if (type == 'H') { // Sobel Horizontal
+		return FIXED_SOBEL_H;
+	}
+	else if (type == 'V') { // Sobel Vertical
+		return FIXED_SOBEL_V;
+	}
+	else if (type == 'G') { // Gaussian Blur
+		return FIXED_GAUSS;
+	}
+	else if (type == 'S') { // Sharpen
+		return FIXED_SHARPEN;
+	}
+	return FIXED_BLUR; // Regular Blur
+}
+
+/**
+ * Convolution Filter function
+ * applies a specific kernel to the image
+ *
+ * @param img - the image to work with
+ * @param type - the type of kernel to use
+ */
+void changeConvolution(Image &img, char type) {
+	int m = convolutionIndex(type);
+	ConvPlan plan;
+	planConvolution(plan, fixedTaps[m].matrix);
+	ConvRowFn interior = fixedKernel(m, plan);
+	// init a temporary image to work with
+	Image tempImg = scratchCopy(img);
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		convolveRows(tempImg, img, plan, interior, begin, end);
+	});
+	releaseScratch(tempImg);
+}
+
+/**
+ * Kernel type
+ * an arbitrary width x height convolution kernel. Like the 3x3
+ * matrices, taps[0] is applied to the pixel up and to the left
+ * of the anchor, which sits at (width/2, height/2)
+ */
+typedef struct {
+	int width, height;
+	float *taps; // row by row
+	float divisor; // the sum is divided by this, then rounded
+} Kernel;
+
+/**
+ * Make Kernel function
+ * builds a kernel from taps held in memory
+ *
+ * @param width - kernel width
+ * @param height - kernel height
+ * @param taps - width*height taps, row by row, copied
+ * @param divisor - what to divide by, 0 for the sum of the taps
+ *  (or 1 when that isn't positive, as changeConvolution does)
+ * @return - the kernel, free with freeKernel()
+ */
+Kernel makeKernel(int width, int height, const float *taps, float divisor) {
+	Kernel k;
+	k.width = width;
+	k.height = height;
+	k.taps = (float*)malloc(sizeof(float) * width * height);
+	memcpy(k.taps, taps, sizeof(float) * width * height);
+	if (divisor == 0) {
+		for (int t = 0; t < width * height; t++) { divisor += taps[t]; }
+		if (divisor <= 1e-6f) { divisor = 1; }
+	}
+	k.divisor = divisor;
+	return k;
+}
+
+void freeKernel(Kernel &k) {
+	free(k.taps);
+	k.taps = NULL;
+}
+
+// largest kernel width or height a file may give
+#define KERNEL_MAX 4096
+
+/**
+ * Load Kernel function
+ * reads a kernel from a text file: its width and height, then the
+ * taps row by row, then optionally the divisor. Integers or
+ * decimals, any whitespace, and # starts a comment, eg.
+ *
+ *     # 5x5 binomial blur
+ *     5 5
+ *     1  4  6  4 1
+ *     ...
+ *
+ * @param name - the file to read
+ * @param k - receives the kernel
+ * @return - whether the file held a valid kernel, anything that
+ * isn't a number making it invalid
+ */
+bool loadKernel(const char *name, Kernel &k) {
+	FILE *file = fopen(name, "r");
+	if (file == NULL) { return false; }
+	int count = 0, size = 64;
+	float *values = (float*)malloc(sizeof(float) * size);
+	char *line = NULL; // whole lines however long, so no number is split
+	size_t capacity = 0;
+	bool numeric = true;
+	while (numeric && getline(&line, &capacity, file) != -1) {
+		char *hash = strchr(line, '#');
+		if (hash != NULL) { *hash = '\0'; }
+		char *save = NULL;
+		for (char *tok = strtok_r(line, " \t\r\n,", &save); tok != NULL; tok = strtok_r(NULL, " \t\r\n,", &save)) {
+			char *end = NULL;
+			double value = strtod(tok, &end);
+			if (*end != '\0' || !isfinite(value)) {
+				numeric = false;
+				break;
+			}
+			if (count == size) {
+				size *= 2;
+				values = (float*)realloc(values, sizeof(float) * size);
+			}
+			values[count++] = (float)value;
+		}
+	}
+	free(line);
+	fclose(file);
+	// range checked before converting, a huge size would overflow the int
+	bool sized = count >= 2 && values[0] >= 1 && values[0] <= KERNEL_MAX && values[1] >= 1 && values[1] <= KERNEL_MAX;
+	int w = sized ? (int)values[0] : 0, h = sized ? (int)values[1] : 0;
+	long long taps = (long long)w * h;
+	bool valid = numeric && sized && values[0] == w && values[1] == h && (count == 2 + taps || count == 3 + taps);
+	if (valid) {
+		k = makeKernel(w, h, values + 2, (count == 3 + taps) ? values[2 + taps] : 0);
+	}
+	free(values);
+	return valid;
+}
+
+/**
+ * Kernel Factors function
+ * checks whether a kernel is the outer product of a column and a
+ * row, by dividing through by the row and column of its largest
+ * tap and checking what comes back
+ *
+ * @param k - the kernel
+ * @param column - receives k.height vertical taps
+ * @param row - receives k.width horizontal taps
+ * @return - whether the kernel is separable
+ */
+bool kernelFactors(const Kernel &k, float *column, float *row) {
+	int pivot = 0;
+	float largest = 0;
+	for (int t = 0; t < k.width * k.height; t++) {
+		if (fabsf(k.taps[t]) > largest) {
+			largest = fabsf(k.taps[t]);
+			pivot = t;
+		}
+	}
+	if (largest == 0) { return false; }
+	int py = pivot / k.width, px = pivot % k.width;
+	for (int y = 0; y < k.height; y++) { column[y] = k.taps[y * k.width + px]; }
+	for (int x = 0; x < k.width; x++) { row[x] = k.taps[py * k.width + x] / k.taps[pivot]; }
+	for (int y = 0; y < k.height; y++) {
+		for (int x = 0; x < k.width; x++) {
+			if (fabsf(column[y] * row[x] - k.taps[y * k.width + x]) > largest * 1e-5f) { return false; }
+		}
+	}
+	return true;
+}
+
+/**
+ * Pad Row function
+ * copies a row with `left` and `right` repeats of its end pixels
+ * so kernel taps can read past the edges without checks
+ */
+void padRow(GLubyte *out, const Pixel *row, int width, int left, int right) {
+	for (int j = 0; j < left; j++, out += 3) { memcpy(out, row, 3); }
+	memcpy(out, row, sizeof(Pixel) * width);
+	out += 3 * width;
+	for (int j = 0; j < right; j++, out += 3) { memcpy(out, row + width - 1, 3); }
+}
+
+/**
+ * Store Row function
+ * scales a row of sums, rounds them and clamps them to 0-255
+ */
+void storeRow(GLubyte *out, const float *sums, int bytes, float scale) {
+	for (int b = 0; b < bytes; b++) {
+		float v = sums[b] * scale + 0.5f;
+		out[b] = (v <= 0) ? 0 : (v >= 255) ? 255 : (GLubyte)v;
+	}
+}
+
+/**
+ * Kernel Direct function
+ * the plain sum over every tap, for rows [begin, end). Edges
+ * repeat their outermost pixel
+ */
+void kernelDirect(const Image &src, Image &dst, const Kernel &k, int begin, int end) {
+	int w = src.width, ax = k.width / 2, ay = k.height / 2, bytes = 3 * w;
+	float *sums = (float*)threadScratch(0, sizeof(float) * bytes);
+	GLubyte *pad = (GLubyte*)threadScratch(1, 3 * (w + k.width));
+	for (int i = begin; i < end; i++) {
+		memset(sums, 0, sizeof(float) * bytes);
+		for (int ky = 0; ky < k.height; ky++) {
+			int y = max(0, min(src.height - 1, i + ky - ay));
+			padRow(pad, src.data + (size_t)y*w, w, ax, k.width - 1 - ax);
+			for (int kx = 0; kx < k.width; kx++) {
+				float t = k.taps[ky * k.width + kx];
+				if (t == 0) { continue; }
+				const GLubyte *p = pad + 3 * kx;
+				for (int b = 0; b < bytes; b++) { sums[b] += t * p[b]; }
+			}
+		}
+		storeRow((GLubyte*)(dst.data + (size_t)i*w), sums, bytes, 1.0f / k.divisor);
+	}
+}
+
+// output rows per block of the separable path
+#define KERNEL_BLOCK 32
+
+/**
+ * Kernel Separable function
+ * a horizontal pass into a block of float rows, then a vertical
+ * pass out of it, for rows [begin, end)
+ */
+void kernelSeparable(const Image &src, Image &dst, const Kernel &k, const float *column,
+	const float *row, int begin, int end) {
+	int w = src.width, ax = k.width / 2, ay = k.height / 2, bytes = 3 * w;
+	GLubyte *pad = (GLubyte*)threadScratch(1, 3 * (w + k.width));
+	float *sums = (float*)threadScratch(0, sizeof(float) * bytes);
+	float *across = (float*)threadScratch(2, sizeof(float) * bytes * (KERNEL_BLOCK + k.height - 1));
+	for (int first = begin; first < end; first += KERNEL_BLOCK) {
+		int last = min(end, first + KERNEL_BLOCK);
+		int rows = last - first + k.height - 1;
+		for (int r = 0; r < rows; r++) { // horizontal, including the halo
+			int y = max(0, min(src.height - 1, first - ay + r));
+			padRow(pad, src.data + (size_t)y*w, w, ax, k.width - 1 - ax);
+			float *out = across + (size_t)r * bytes;
+			memset(out, 0, sizeof(float) * bytes);
+			for (int kx = 0; kx < k.width; kx++) {
+				float t = row[kx];
+				if (t == 0) { continue; }
+				const GLubyte *p = pad + 3 * kx;
+				for (int b = 0; b < bytes; b++) { out[b] += t * p[b]; }
+			}
+		}
+		for (int i = first; i < last; i++) { // then vertical
+			memset(sums, 0, sizeof(float) * bytes);
+			for (int ky = 0; ky < k.height; ky++) {
+				float t = column[ky];
+				if (t == 0) { continue; }
+				const float *p = across + (size_t)(i - first + ky) * bytes;
+				for (int b = 0; b < bytes; b++) { sums[b] += t * p[b]; }
+			}
+			storeRow((GLubyte*)(dst.data + (size_t)i*w), sums, bytes, 1.0f / k.divisor);
+		}
+	}
+}
+
+typedef std::complex<float> Complex;
+
+/**
+ * FFT function
+ * in place iterative radix-2 FFT of n (a power of two) complex
+ * values spaced `stride` apart
+ *
+ * @param a - the data
+ * @param n - number of values
+ * @param stride - distance between values
+ * @param twiddle - exp(-2 pi i k / n) for k < n/2
+ * @param inverse - run the unscaled inverse transform instead
+ */
+void fft(Complex *a, int n, int stride, const Complex *twiddle, bool inverse) {
+	for (int i = 1, j = 0; i < n; i++) { // bit reversal permutation
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) { j ^= bit; }
+		j ^= bit;
+		if (i < j) { std::swap(a[i * stride], a[j * stride]); }
+	}
+	for (int len = 2; len <= n; len <<= 1) {
+		int step = n / len;
+		for (int i = 0; i < n; i += len) {
+			for (int j = 0; j < len / 2; j++) {
+				Complex w = inverse ? conj(twiddle[j * step]) : twiddle[j * step];
+				Complex u = a[(i + j) * stride], v = a[(i + j + len / 2) * stride] * w;
+				a[(i + j) * stride] = u + v;
+				a[(i + j + len / 2) * stride] = u - v;
+			}
+		}
+	}
+}
+
+/**
+ * FFT 2D function
+ * transforms a size x size tile, rows then columns
+ */
+void fft2d(Complex *a, int size, const Complex *twiddle, bool inverse) {
+	for (int y = 0; y < size; y++) { fft(a + (size_t)y * size, size, 1, twiddle, inverse); }
+	for (int x = 0; x < size; x++) { fft(a + x, size, size, twiddle, inverse); }
+}
+
+/**
+ * FFT Tile Size function
+ * the power of two tile that makes overlap-save cheapest per
+ * output pixel for a kernel: bigger tiles waste less on overlap
+ * but cost more per pixel to transform
+ *
+ * @param k - the kernel
+ * @param cost - receives the estimated cost per output pixel
+ * @return - the tile size
+ */
+int fftTileSize(const Kernel &k, float &cost) {
+	int best = 0;
+	cost = 0;
+	for (int size = 16; size <= 1024; size <<= 1) {
+		int outW = size - k.width + 1, outH = size - k.height + 1;
+		if (outW < 1 || outH < 1) { continue; }
+		// two forward and two inverse transforms cover three channels
+		float c = 4.0f * size * size * 2 * log2f((float)size) / ((float)outW * outH);
+		if (best == 0 || c < cost) {
+			best = size;
+			cost = c;
+		}
+	}
+	return best;
+}
+
+/**
+ * Kernel FFT function
+ * overlap-save convolution in size x size tiles. Red and green
+ * ride through one complex transform as its real and imaginary
+ * parts, which a real kernel keeps apart, and blue through a
+ * second
+ *
+ * @param src - unmodified copy of the image
+ * @param dst - the image to write
+ * @param k - the kernel
+ * @param size - the tile size, see fftTileSize()
+ */
+void kernelFFT(const Image &src, Image &dst, const Kernel &k, int size) {
+	int ax = k.width / 2, ay = k.height / 2;
+	int outW = size - k.width + 1, outH = size - k.height + 1;
+	int tilesX = (src.width + outW - 1) / outW, tilesY = (src.height + outH - 1) / outH;
+	size_t cells = (size_t)size * size;
+	Complex *twiddle = (Complex*)acquireBuffer(sizeof(Complex) * size / 2);
+	for (int j = 0; j < size / 2; j++) {
+		twiddle[j] = std::polar(1.0f, (float)(-2 * M_PI * j / size));
+	}
+	/**
+	 * the kernel goes in reversed and wrapped around, which turns
+	 * the transform's circular convolution into the correlation
+	 * the 3x3 filters compute, anchored at the tile's corner
+	 */
+	Complex *spectrum = (Complex*)acquireBuffer(sizeof(Complex) * cells);
+	for (size_t c = 0; c < cells; c++) { spectrum[c] = 0; }
+	for (int ky = 0; ky < k.height; ky++) {
+		for (int kx = 0; kx < k.width; kx++) {
+			spectrum[(size_t)((size - ky) % size) * size + (size - kx) % size] = k.taps[ky * k.width + kx];
+		}
+	}
+	fft2d(spectrum, size, twiddle, false);
+	float scale = 1.0f / (k.divisor * cells);
+	parallelRows(tilesX * tilesY, outW * outH, [&](int begin, int end) {
+		Complex *rg = (Complex*)threadScratch(0, sizeof(Complex) * cells);
+		Complex *b = (Complex*)threadScratch(1, sizeof(Complex) * cells);
+		for (int t = begin; t < end; t++) {
+			int oy = (t / tilesX) * outH, ox = (t % tilesX) * outW;
+			for (int y = 0; y < size; y++) { // gather, repeating the edges
+				const Pixel *row = src.data + (size_t)max(0, min(src.height - 1, oy - ay + y)) * src.width;
+				for (int x = 0; x < size; x++) {
+					const Pixel &p = row[max(0, min(src.width - 1, ox - ax + x))];
+					rg[(size_t)y * size + x] = Complex(p.red, p.green);
+					b[(size_t)y * size + x] = Complex(p.blue, 0);
+				}
+			}
+			fft2d(rg, size, twiddle, false);
+			fft2d(b, size, twiddle, false);
+			for (size_t c = 0; c < cells; c++) {
+				rg[c] *= spectrum[c];
+				b[c] *= spectrum[c];
+			}
+			fft2d(rg, size, twiddle, true);
+			fft2d(b, size, twiddle, true);
+			for (int y = 0; y < outH && oy + y < src.height; y++) {
+				GLubyte *out = (GLubyte*)(dst.data + (size_t)(oy + y) * dst.width + ox);
+				for (int x = 0; x < outW && ox + x < src.width; x++, out += 3) {
+					float sums[3] = { rg[(size_t)y * size + x].real(), rg[(size_t)y * size + x].imag(),
+						b[(size_t)y * size + x].real() };
+					storeRow(out, sums, 3, scale);
+				}
+			}
+		}
+	});
+	releaseBuffer(spectrum);
+	releaseBuffer(twiddle);
+}
+
+/**
+ * Kernel Filter function
+ * convolves an image with an arbitrary kernel, picking the
+ * cheapest of the direct, separable and FFT methods by how many
+ * operations each needs per pixel. FFT_COST scales the FFT
+ * estimate to match the direct sums; --bench-kernels measures
+ * where the crossover really falls
+ *
+ * @param img - the image to work with
+ * @param k - the kernel
+ * @param method - 'D' direct, 'S' separable, 'F' FFT, 'A' pick
+ */
+#define FFT_COST 3.0f
+void changeKernel(Image &img, const Kernel &k, char method) {
+	float *column = (float*)malloc(sizeof(float) * (k.height + k.width));
+	float *row = column + k.height;
+	bool separable = kernelFactors(k, column, row);
+	float fftCost;
+	int size = fftTileSize(k, fftCost);
+	if (method == 'A') {
+		float directCost = (float)k.width * k.height * 3;
+		float cheapest = separable ? (k.width + k.height) * 3.0f : directCost;
+		method = separable ? 'S' : 'D';
+		if (size > 0 && fftCost * FFT_COST < cheapest) { method = 'F'; }
+	}
+	if (method == 'S' && !separable) { method = 'D'; }
+	Image src = scratchCopy(img);
+	if (method == 'F' && size > 0) {
+		kernelFFT(src, img, k, size);
+	}
+	else {
+		parallelRows(img.height, img.width, [&](int begin, int end) {
+			if (method == 'S') { kernelSeparable(src, img, k, column, row, begin, end); }
+			else { kernelDirect(src, img, k, begin, end); }
+		});
+	}
+	releaseScratch(src);
+	free(column);
+}
+
+// the kernel method, 'A' picks per kernel (--kernel-method)
+char kernelMethod = 'A';
+
+// the kernel key l applies when not given a file (--kernel)
+Kernel customKernel = { 0, 0, NULL, 1 };
+
+/**
+ * Apply Kernel function
+ * convolves with a kernel file, or the --kernel one
+ *
+ * @param img - the image to work with
+ * @param name - the kernel file, NULL for customKernel
+ * @return - whether there was a kernel to apply
+ */
+bool applyKernel(Image &img, const char *name) {
+	if (name == NULL) {
+		if (customKernel.taps == NULL) {
+			cerr << "no kernel loaded, start with --kernel FILE" << endl;
+			return false;
+		}
+		changeKernel(img, customKernel, kernelMethod);
+		return true;
+	}
+	Kernel k;
+	if (!loadKernel(name, k)) {
+		cerr << "could not read a kernel from " << name << endl;
+		return false;
+	}
+	changeKernel(img, k, kernelMethod);
+	freeKernel(k);
+	return true;
+}
+
+/**
+ * Benchmark Kernels function
+ * times the direct, separable and FFT methods on square box
+ * kernels of growing size over a synthetic image, to show where
+ * each method stops paying off (--bench-kernels)
+ *
+ * @param width - test image width
+ * @param height - test image height
+ */
+void benchKernels(int width, int height) {
+	Image img;
+	img.width = width;
+	img.height = height;
+	img.bitmap = NULL;
+	img.mapping = NULL;
+	img.data = (Pixel*)malloc(sizeof(Pixel) * width * height);
+	for (size_t p = 0; p < (size_t)width * height; p++) {
+		img.data[p].red = rand() & 255;
+		img.data[p].green = rand() & 255;
+		img.data[p].blue = rand() & 255;
+	}
+	const char methods[] = "DSF";
+	int crossover = 0;
+	cout << "size\tdirect\tseparable\tfft\t(ms, " << width << "x" << height << ")" << endl;
+	for (int size = 3; size <= 63; size += (size < 15) ? 2 : 8) {
+		float *taps = (float*)malloc(sizeof(float) * size * size);
+		for (int t = 0; t < size * size; t++) { taps[t] = 1; }
+		Kernel k = makeKernel(size, size, taps, 0);
+		free(taps);
+		double ms[3];
+		cout << size;
+		for (int m = 0; m < 3; m++) {
+			// direct grows with the kernel area, so skip the hopeless
+			if (m == 0 && size > 31) {
+				ms[m] = 0;
+				cout << "\t-";
+				continue;
+			}
+			double start = seconds();
+			changeKernel(img, k, methods[m]);
+			ms[m] = (seconds() - start) * 1000;
+			cout << "\t" << ms[m];
+		}
+		cout << endl;
+		if (crossover == 0 && ms[0] > 0 && ms[2] < ms[0]) { crossover = size; }
+		freeKernel(k);
+	}
+	if (crossover) { cout << "fft beats direct from " << crossover << "x" << crossover << endl; }
+	free(img.data);
+	trimScratch();
+}
+
+/**
+ * Benchmark Specialized function
+ * times the runtime dispatched filter loops against the versions
+ * specialized at compile time, per filter and for convolutions per
+ * SIMD level, taking the best of five runs (--bench-specialized)
+ *
+ * @param width - test image width
+ * @param height - test image height
+ */
+void benchSpecialized(int width, int height) {
+	Image img;
+	img.width = width;
+	img.height = height;
+	img.bitmap = NULL;
+	img.mapping = NULL;
+	img.data = (Pixel*)malloc(sizeof(Pixel) * width * height);
+	for (size_t p = 0; p < (size_t)width * height; p++) {
+		img.data[p].red = rand() & 255;
+		img.data[p].green = rand() & 255;
+		img.data[p].blue = rand() & 255;
+	}
+	auto best = [&](auto run) { // ms
+		double fastest = 1e30;
+		for (int r = 0; r < 5; r++) {
+			double start = seconds();
+			run();
+			fastest = min(fastest, seconds() - start);
+		}
+		return fastest * 1000;
+	};
+	cout << "filter\t\tgeneric\tfixed\t(ms, " << width << "x" << height << ")" << endl;
+	static const struct {
+		const char *name;
+		SpanFn generic;
+		SpanFn (*fixed)(char);
+		const char *types;
+	} spans[] = {
+		{ "grey", greySpan, greySpanFor, "GN" },
+		{ "mono", monochromeSpanFloat, [](char) { return monochromeSpanFor(); }, "-" },
+		{ "sepia", sepiaSpanFloat, [](char) { return sepiaSpanFor(); }, "-" },
+		{ "channel", singleChannelSpan, singleChannelSpanFor, "RGB" },
+		{ "intensity", intensitySpan, intensitySpanFor, "RGB" }
+	};
+	for (const auto &span : spans) {
+		for (const char *t = span.types; *t != '\0'; t++) {
+			double generic = best([&]() { forEachSpan(img, span.generic, *t); });
+			double fixed = best([&]() { forEachSpan(img, span.fixed(*t), *t); });
+			cout << span.name << " " << *t << "\t" << generic << "\t" << fixed << endl;
+		}
+	}
+	static const char types[] = { 'C', 'G', 'S' }, *names[] = { "blur", "gauss", "sharpen" };
+	int savedCap = simdCap, levels = simdLevel();
+	Image src = copyImage(img);
+	for (int level = 0; level <= levels; level++) {
+		simdCap = level;
+		for (int k = 0; k < 3; k++) {
+			int m = convolutionIndex(types[k]);
+			ConvPlan plan;
+			planConvolution(plan, fixedTaps[m].matrix);
+			ConvRowFn generic = interiorKernel(plan), fixed = fixedKernel(m, plan);
+			double ms[2];
+			for (int v = 0; v < 2; v++) {
+				ConvRowFn interior = v ? fixed : generic;
+				ms[v] = best([&]() {
+					parallelRows(img.height, img.width, [&](int begin, int end) {
+						convolveRows(src, img, plan, interior, begin, end);
+					});
+				});
+			}
+			cout << names[k] << " simd " << level << "\t" << ms[0] << "\t" << ms[1] << endl;
+		}
+	}
+	simdCap = savedCap;
+	free(src.data);
+	free(img.data);
+	trimScratch();
+}
+
+/**
+ * Palette type
+ * up to 256 colours for the quantizer to choose from
+ */
+typedef struct {
+	int count;
+	int color[256][3];
+} Palette;
+
+/**
+ * Closest Neighbor function
+ * finds the palette colour nearest a pixel in RGB-space. Squared
+ * distance orders colours the same as the distance, so no sqrt
+ *
+ * @param col - the pixel's red, green and blue
+ * @param pal - the palette
+ * @param index - candidate palette indexes to search
+ * @param count - number of candidates
+ * @return - the closest index, the first on ties
+ */
+int checkCloser(const int col[3], const Palette &pal, const GLubyte *index, int count) {
+	int closest = index[0], best = 0x7fffffff;
+	for (int i = 0; i < count; i++) {
+		const int *c = pal.color[index[i]];
+		int dist = (col[0] - c[0]) * (col[0] - c[0]) + (col[1] - c[1]) * (col[1] - c[1]) +
+			(col[2] - c[2]) * (col[2] - c[2]);
+		if (dist < best) {
+			best = dist;
+			closest = index[i];
+		}
+	}
+	return closest;
+}
+
+// the nearest colour table has 32 cells per channel, 8 values wide
+#define NEAREST_BITS 5
+#define NEAREST_CELLS (1 << (3 * NEAREST_BITS))
+
+// the cell of the nearest colour table holding a colour
+inline int nearestCell(int r, int g, int b) {
+	int drop = 8 - NEAREST_BITS;
+	return (r >> drop) << (2 * NEAREST_BITS) | (g >> drop) << NEAREST_BITS | (b >> drop);
+}
+
+/**
+ * Nearest Table type
+ * for each cell of RGB-space, the only palette colours that can be
+ * nearest to something in it. Most cells end up with one, so a
+ * lookup costs about the same however big the palette is
+ */
+typedef struct {
+	int offset[NEAREST_CELLS + 1]; // cell c's candidates are index[offset[c]..offset[c+1])
+	GLubyte *index;
+} NearestTable;
+
+/**
+ * Cell Candidates function
+ * lists the palette colours that could be nearest to some point
+ * of a cell: those whose closest approach to the cell is no
+ * further than the best colour's furthest
+ *
+ * @param pal - the palette
+ * @param bits - cells per channel, as a power of two
+ * @param cell - the cell number
+ * @param from - the colours worth checking, from an enclosing cell
+ * @param count - number of colours in from
+ * @param out - receives the candidates, NULL to just count them
+ * @return - number of candidates
+ */
+int cellCandidates(const Palette &pal, int bits, int cell, const GLubyte *from, int count, GLubyte *out) {
+	int width = 256 >> bits, low[3], near[256], bound = 0x7fffffff;
+	low[0] = (cell >> (2 * bits)) * width;
+	low[1] = ((cell >> bits) & ((1 << bits) - 1)) * width;
+	low[2] = (cell & ((1 << bits) - 1)) * width;
+	for (int i = 0; i < count; i++) {
+		int nearest = 0, furthest = 0;
+		for (int c = 0; c < 3; c++) {
+			int v = pal.color[from[i]][c], high = low[c] + width - 1;
+			int in = (v < low[c]) ? low[c] - v : (v > high) ? v - high : 0;
+			int out = max(v - low[c], high - v);
+			nearest += in * in;
+			furthest += out * out;
+		}
+		near[i] = nearest;
+		bound = min(bound, furthest);
+	}
+	int found = 0;
+	for (int i = 0; i < count; i++) {
+		if (near[i] <= bound) {
+			if (out != NULL) { out[found] = from[i]; }
+			found++;
+		}
+	}
+	return found;
+}
+
+// cells per channel of the coarse pass of buildNearest()
+#define COARSE_BITS 3
+
+/**
+ * Build Nearest function
+ * fills a nearest colour table for a palette. Candidates are found
+ * for coarse cells first, so each fine cell only checks the few
+ * its coarse cell kept rather than the whole palette
+ *
+ * @param pal - the palette
+ * @param table - the table to fill, free its index afterwards
+ */
+void buildNearest(const Palette &pal, NearestTable &table) {
+	int coarseCells = 1 << (3 * COARSE_BITS), cells = NEAREST_CELLS, *offset = table.offset;
+	int *coarseCount = (int*)malloc(sizeof(int) * coarseCells);
+	GLubyte *coarse = (GLubyte*)malloc((size_t)coarseCells * 256), all[256];
+	for (int i = 0; i < pal.count; i++) { all[i] = (GLubyte)i; }
+	for (int c = 0; c < coarseCells; c++) {
+		coarseCount[c] = cellCandidates(pal, COARSE_BITS, c, all, pal.count, coarse + c * 256);
+	}
+	// the coarse cell enclosing fine cell c
+	int drop = NEAREST_BITS - COARSE_BITS, mask = (1 << COARSE_BITS) - 1;
+	auto parent = [&](int c) {
+		return ((c >> (2 * NEAREST_BITS + drop)) & mask) << (2 * COARSE_BITS) |
+			((c >> (NEAREST_BITS + drop)) & mask) << COARSE_BITS | ((c >> drop) & mask);
+	};
+	parallelRows(cells, 16, [&](int begin, int end) {
+		for (int c = begin; c < end; c++) {
+			int p = parent(c);
+			offset[c + 1] = cellCandidates(pal, NEAREST_BITS, c, coarse + p * 256, coarseCount[p], NULL);
+		}
+	});
+	offset[0] = 0;
+	for (int c = 0; c < cells; c++) { offset[c + 1] += offset[c]; }
+	table.index = (GLubyte*)malloc(offset[cells]);
+	parallelRows(cells, 16, [&](int begin, int end) {
+		for (int c = begin; c < end; c++) {
+			int p = parent(c);
+			cellCandidates(pal, NEAREST_BITS, c, coarse + p * 256, coarseCount[p], table.index + offset[c]);
+		}
+	});
+	free(coarse);
+	free(coarseCount);
+}
+
+/**
+ * Median Cut Palette function
+ * picks colours for an image: a histogram of its colours is
+ * repeatedly split at the median of whichever box spans the widest
+ * range, then a few rounds of k-means pull each colour to the
+ * middle of the pixels it ends up with. A colour that ends up with
+ * none stays where it was
+ *
+ * @param img - the image to choose colours for
+ * @param colors - how many colours, 1-256
+ * @param pal - receives the palette
+ */
+#define KMEANS_ROUNDS 4
+void medianCutPalette(const Image &img, int colors, Palette &pal) {
+	// histogram by table cell, keeping full precision sums
+	int cells = NEAREST_CELLS, used = 0;
+	long long *sum = (long long*)calloc(cells, sizeof(long long) * 4);
+	size_t pixels = (size_t)img.width * img.height;
+	for (size_t p = 0; p < pixels; p++) {
+		const Pixel &px = img.data[p];
+		long long *s = sum + 4 * nearestCell(px.red, px.green, px.blue);
+		s[0]++;
+		s[1] += px.red;
+		s[2] += px.green;
+		s[3] += px.blue;
+	}
+	int *entry = (int*)malloc(sizeof(int) * cells); // occupied cells, in box order
+	int (*mean)[3] = (int(*)[3])malloc(sizeof(int) * 3 * cells);
+	for (int c = 0; c < cells; c++) {
+		if (sum[4 * c] == 0) { continue; }
+		for (int k = 0; k < 3; k++) { mean[c][k] = (int)(sum[4 * c + k + 1] / sum[4 * c]); }
+		entry[used++] = c;
+	}
+	int start[257], end[257], boxes = 1;
+	start[0] = 0;
+	end[0] = used;
+	while (boxes < colors) {
+		int widest = -1, range = 0, axis = 0;
+		for (int b = 0; b < boxes; b++) {
+			if (end[b] - start[b] < 2) { continue; }
+			for (int k = 0; k < 3; k++) {
+				int lo = 255, hi = 0;
+				for (int e = start[b]; e < end[b]; e++) {
+					lo = min(lo, mean[entry[e]][k]);
+					hi = max(hi, mean[entry[e]][k]);
+				}
+				if (hi - lo > range) {
+					range = hi - lo;
+					widest = b;
+					axis = k;
+				}
+			}
+		}
+		if (widest < 0) { break; } // fewer colours in the image than asked for
+		int *first = entry + start[widest], *last = entry + end[widest];
+		std::sort(first, last, [&](int a, int b) { // cell order breaks ties, so the split is the same every run
+			return mean[a][axis] < mean[b][axis] || (mean[a][axis] == mean[b][axis] && a < b);
+		});
+		long long total = 0, half = 0;
+		for (int *e = first; e < last; e++) { total += sum[4 * *e]; }
+		int *split = first;
+		// stop a cell short of the end, so the upper box is never empty
+		while (split < last - 2 && (half += sum[4 * *split]) * 2 < total) { split++; }
+		split++; // the median cell ends the lower box
+		start[boxes] = split - entry;
+		end[boxes] = end[widest];
+		end[widest] = split - entry;
+		boxes++;
+	}
+	pal.count = boxes;
+	int *owner = (int*)malloc(sizeof(int) * cells);
+	for (int b = 0; b < boxes; b++) {
+		for (int e = start[b]; e < end[b]; e++) { owner[entry[e]] = b; }
+	}
+	for (int round = 0; round <= KMEANS_ROUNDS; round++) {
+		long long acc[256][4];
+		memset(acc, 0, sizeof(acc));
+		for (int e = 0; e < used; e++) {
+			long long *s = sum + 4 * entry[e], *a = acc[owner[entry[e]]];
+			for (int k = 0; k < 4; k++) { a[k] += s[k]; }
+		}
+		for (int b = 0; b < boxes; b++) {
+			if (acc[b][0] == 0) { continue; } // lost every pixel, keeps its last colour rather than black
+			for (int k = 0; k < 3; k++) { pal.color[b][k] = (int)((acc[b][k + 1] + acc[b][0] / 2) / acc[b][0]); }
+		}
+		if (round == KMEANS_ROUNDS) { break; }
+		GLubyte all[256];
+		for (int b = 0; b < boxes; b++) { all[b] = (GLubyte)b; }
+		for (int e = 0; e < used; e++) {
+			owner[entry[e]] = checkCloser(mean[entry[e]], pal, all, boxes);
+		}
+	}
+	free(owner);
+	free(mean);
+	free(entry);
+	free(sum);
+}
+
+// palette size of key m (--colors)
+int paletteColors = 16;
+
+/**
+ * Quantizer Filter function
+ * apply a quantized filter to image
+ *
+ * @param img - the image to work with
+ * @param type - the type of filter, 'F' fixed 9 colours, 'R' random
+ *  colours, 'M' colours picked from the image by median cut
+ * @param colors - number of colours for 'R' and 'M', up to 256
+ * @param seed - for 'R', picks the same palette every time it is
+ *  given, 0 for a new one
+ */
+void changeQuantize(Image &img, char type, int colors = 9, unsigned seed = 0) {
+	srand(time(NULL)); // seed for random
+	Palette pal;
+	int vals[9][3] = {
+		{ 255, 0, 0 },{ 0, 255, 0 },{ 0, 0, 255 }, // red, green, blue
+		{ 255, 255, 255 },{ 0, 0, 0 },{ 128, 128, 128 }, // black, white, grey
+		{ 128, 128, 0 },{ 0, 128, 128 },{ 128, 0, 128 } // combos of RGB
+	};
+	colors = max(1, min(256, colors));
+	if (type == 'R') { // if random modifier
+		pal.count = colors;
+		for (int i = 0; i < colors; i++) {
+			for (int j = 0; j < 3; j++) { // 3 channels per color
+				if (seed != 0) { // xorshift, so a seeded palette is the same everywhere
+					seed ^= seed << 13;
+					seed ^= seed >> 17;
+					seed ^= seed << 5;
+				}
+				pal.color[i][j] = ((seed != 0) ? seed : rand()) % 255; // random value 0-255 per channel
+			}
+		}
+	}
+	else if (type == 'M') {
+		medianCutPalette(img, colors, pal);
+	}
+	else {
+		pal.count = 9;
+		memcpy(pal.color, vals, sizeof(vals));
+	}
+	NearestTable *table = (NearestTable*)malloc(sizeof(NearestTable));
+	buildNearest(pal, *table);
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		int col[3] = { 0, 0, 0 }; // placeholder to put temp color values
+		Pixel *p = img.data + (size_t)begin*img.width;
+		for (int k = 0; k < (end - begin)*img.width; k++) {
+			col[0] = p[k].red;
+			col[1] = p[k].green;
+			col[2] = p[k].blue;
+			int cell = nearestCell(col[0], col[1], col[2]);
+			const GLubyte *cand = table->index + table->offset[cell];
+			int n = table->offset[cell + 1] - table->offset[cell];
+			// find index of closest color, usually the only candidate
+			int closest = (n == 1) ? cand[0] : checkCloser(col, pal, cand, n);
+			p[k].red = pal.color[closest][0];
+			p[k].green = pal.color[closest][1];
+			p[k].blue = pal.color[closest][2];
+		}
+	});
+	free(table->index);
+	free(table);
+}
+
+/**
+ * Negative Span function
+ * the per pixel work of changeNegative() over n pixels
+ */
+void negativeSpan(Pixel *p, int n, char type) {
+	for (int k = 0; k < n; k++) {
+		// basically just set to |RGB-255|
+		p[k].red = abs(p[k].red - 255);
+		p[k].green = abs(p[k].green - 255);
+		p[k].blue = abs(p[k].blue - 255);
+	}
+}
+
+/**
+ * Negative Filter function
+ * changes image to color negative
+ *
+ * @param img - the image to negate
+ */
+void changeNegative(Image &img) {
+	forEachSpan(img, negativeSpan, 0);
+}
+
+/**
+ * Display state
+ * workBuffer is shown as a grid of textures no bigger than the GL
+ * allows, refreshed through a pixel buffer object that is kept for
+ * the whole session. Only rows marked dirty since the last redraw
+ * are uploaded, so zooming and panning cost no uploads at all.
+ * The view is in saveBuffer's pixels, and a smaller preview level
+ * in workBuffer is stretched to cover the same area. Without GL 2.1
+ * (PBOs, any texture size) it falls back to glDrawPixels
+ */
+typedef struct {
+	GLuint texture;
+	int x, y, width, height; // the part of the image it holds
+} DisplayTile;
+static DisplayTile *displayTiles = NULL;
+static int displayTileCount = 0;
+static GLuint displayPBO = 0;
+static size_t displayPBOSize = 0;
+static bool displayTextured = false;
+static int dirtyFirst = 0, dirtyLast = 0; // rows [first, last) to upload
+static int windowWidth = 1, windowHeight = 1;
+static float viewZoom = 1, viewX = 0, viewY = 0; // image point at the window's corner
+
+/**
+ * Mark Dirty function
+ * notes that rows [first, last) of workBuffer changed and need
+ * uploading before the next redraw
+ */
+void markDirty(int first, int last) {
+	if (dirtyFirst >= dirtyLast) {
+		dirtyFirst = first;
+		dirtyLast = last;
+	}
+	else {
+		dirtyFirst = min(dirtyFirst, first);
+		dirtyLast = max(dirtyLast, last);
+	}
+}
+
+/**
+ * Make Display Tiles function
+ * (re)creates the textures for workBuffer's size, when the window
+ * opens and whenever a preview level of another size is swapped in
+ */
+void makeDisplayTiles() {
+	for (int t = 0; t < displayTileCount; t++) { glDeleteTextures(1, &displayTiles[t].texture); }
+	free(displayTiles);
+	markDirty(0, workBuffer.height);
+	GLint largest = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &largest);
+	int tile = max(64, (int)largest);
+	int across = (workBuffer.width + tile - 1) / tile, down = (workBuffer.height + tile - 1) / tile;
+	displayTileCount = across * down;
+	displayTiles = (DisplayTile*)malloc(sizeof(DisplayTile) * displayTileCount);
+	for (int t = 0; t < displayTileCount; t++) {
+		DisplayTile &d = displayTiles[t];
+		d.x = (t % across) * tile;
+		d.y = (t / across) * tile;
+		d.width = min(tile, workBuffer.width - d.x);
+		d.height = min(tile, workBuffer.height - d.y);
+		glGenTextures(1, &d.texture);
+		glBindTexture(GL_TEXTURE_2D, d.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, d.width, d.height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	}
+}
+
+/**
+ * Init Display function
+ * creates the textures and pixel buffer once the window exists
+ */
+void initDisplay() {
+	const char *version = (const char*)glGetString(GL_VERSION);
+	int major = 0, minor = 0;
+	if (version != NULL) { sscanf(version, "%d.%d", &major, &minor); }
+	displayTextured = major > 2 || (major == 2 && minor >= 1);
+	markDirty(0, workBuffer.height);
+	if (!displayTextured) { return; }
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Pixel rows aren't padded
+	makeDisplayTiles();
+	glGenBuffers(1, &displayPBO);
+}
+
+/**
+ * Upload Dirty function
+ * copies the dirty rows into the pixel buffer, which is orphaned
+ * first so the driver never waits on a draw still reading it, then
+ * has every tile they cross pull its part from there
+ */
+void uploadDirty() {
+	if (dirtyFirst >= dirtyLast) { return; }
+	int first = dirtyFirst, rows = dirtyLast - dirtyFirst, w = workBuffer.width;
+	size_t bytes = sizeof(Pixel) * w * rows;
+	dirtyFirst = dirtyLast = 0;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, displayPBO);
+	if (bytes > displayPBOSize) { displayPBOSize = sizeof(Pixel) * w * workBuffer.height; }
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, displayPBOSize, NULL, GL_STREAM_DRAW);
+	GLubyte *mapped = (GLubyte*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY); // not glMapBufferRange, that's GL 3.0
+	const GLubyte *src = (const GLubyte*)(workBuffer.data + (size_t)first * w);
+	if (mapped != NULL) {
+		parallelRows(rows, w, [&](int begin, int end) {
+			memcpy(mapped + sizeof(Pixel) * w * begin, src + sizeof(Pixel) * w * begin, sizeof(Pixel) * w * (end - begin));
+		});
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		src = NULL; // offsets into the PBO from here on
+	}
+	else {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // upload straight from memory
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+	for (int t = 0; t < displayTileCount; t++) {
+		DisplayTile &d = displayTiles[t];
+		int top = max(first, d.y), bottom = min(first + rows, d.y + d.height);
+		if (top >= bottom) { continue; }
+		glBindTexture(GL_TEXTURE_2D, d.texture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, top - d.y, d.width, bottom - top, GL_RGB, GL_UNSIGNED_BYTE,
+			src + sizeof(Pixel) * ((size_t)(top - first) * w + d.x));
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+/**
+* Display Image function
+* draws workBuffer as textured quads at the current zoom and pan,
+* or without GL 2.1 as zoomed pixels placed the same way
+*/
+void displayImage(void) {
+	PROFILE_SCOPE("display", 0, (size_t)workBuffer.width * workBuffer.height);
+	glClear(GL_COLOR_BUFFER_BIT);
+	// a preview level's pixels cover several of saveBuffer's
+	float scaleX = (float)saveBuffer.width / workBuffer.width, scaleY = (float)saveBuffer.height / workBuffer.height;
+	if (!displayTextured) { // the original path
+		glRasterPos2i(0, 0);
+		glBitmap(0, 0, 0, 0, -viewX * viewZoom, -viewY * viewZoom, NULL); // moves it even off the window
+		glPixelZoom(viewZoom * scaleX, viewZoom * scaleY);
+		glDrawPixels(workBuffer.width, workBuffer.height, GL_RGB, GL_UNSIGNED_BYTE, (GLubyte*)workBuffer.data);
+		glPixelZoom(1, 1);
+		dirtyFirst = dirtyLast = 0;
+		glutSwapBuffers();
+		return;
+	}
+	uploadDirty();
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+	GLint filter = (viewZoom * scaleX < 1) ? GL_LINEAR : GL_NEAREST; // crisp pixels zoomed in
+	for (int t = 0; t < displayTileCount; t++) {
+		DisplayTile &d = displayTiles[t];
+		float x0 = (d.x * scaleX - viewX) * viewZoom, y0 = (d.y * scaleY - viewY) * viewZoom;
+		float x1 = x0 + d.width * scaleX * viewZoom, y1 = y0 + d.height * scaleY * viewZoom;
+		if (x1 < 0 || y1 < 0 || x0 > windowWidth || y0 > windowHeight) { continue; }
+		glBindTexture(GL_TEXTURE_2D, d.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+		glBegin(GL_QUADS);
+		glTexCoord2f(0, 0); glVertex2f(x0, y0);
+		glTexCoord2f(1, 0); glVertex2f(x1, y0);
+		glTexCoord2f(1, 1); glVertex2f(x1, y1);
+		glTexCoord2f(0, 1); glVertex2f(x0, y1);
+		glEnd();
+	}
+	glDisable(GL_TEXTURE_2D);
+	glutSwapBuffers();
+}
+
+/**
+ * Reshape function
+ * keeps one unit a window pixel however the window is sized
+ */
+void reshapeWindow(int width, int height) {
+	windowWidth = max(1, width);
+	windowHeight = max(1, height);
+	glViewport(0, 0, windowWidth, windowHeight);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	glOrtho(0, windowWidth, 0, windowHeight, -1, 1);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	static bool opened = false;
+	if (!opened && (saveBuffer.width > windowWidth || saveBuffer.height > windowHeight)) {
+		fitView(); // too big for the first window, show all of it
+	}
+	opened = true;
+}
+
+/**
+ * Zoom View function
+ * scales the view about a window point, keeping the image point
+ * under it still
+ *
+ * @param factor - how much to zoom in, below 1 zooms out
+ * @param x - window x, from the left
+ * @param y - window y, from the bottom
+ */
+void zoomView(float factor, int x, int y) {
+	float zoom = max(1.0f / 64, min(64.0f, viewZoom * factor));
+	viewX += x / viewZoom - x / zoom;
+	viewY += y / viewZoom - y / zoom;
+	viewZoom = zoom;
+	choosePreviewLevel();
+	glutPostRedisplay();
+}
+
+/**
+ * Fit View function
+ * shows the whole image, as large as the window allows
+ */
+void fitView() {
+	viewZoom = min((float)windowWidth / saveBuffer.width, (float)windowHeight / saveBuffer.height);
+	viewX = (saveBuffer.width - windowWidth / viewZoom) / 2;
+	viewY = (saveBuffer.height - windowHeight / viewZoom) / 2;
+	choosePreviewLevel();
+	glutPostRedisplay();
+}
+
+/**
+ * Special Key Handler function
+ * arrow keys pan by a tenth of the window, page up/down zoom
+ */
+void specialKey(int key, int x, int y) {
+	float stepX = windowWidth / 10.0f / viewZoom, stepY = windowHeight / 10.0f / viewZoom;
+	switch (key) {
+	case GLUT_KEY_LEFT: { viewX -= stepX; break; }
+	case GLUT_KEY_RIGHT: { viewX += stepX; break; }
+	case GLUT_KEY_UP: { viewY += stepY; break; }
+	case GLUT_KEY_DOWN: { viewY -= stepY; break; }
+	case GLUT_KEY_PAGE_UP: { zoomView(2, windowWidth / 2, windowHeight / 2); return; }
+	case GLUT_KEY_PAGE_DOWN: { zoomView(0.5f, windowWidth / 2, windowHeight / 2); return; }
+	default: { return; }
+	}
+	glutPostRedisplay();
+}
+
+// where a drag last was, in window pixels from the bottom left
+static int dragX = -1, dragY = -1;
+
+/**
+ * Mouse Handler function
+ * the wheel zooms about the pointer, dragging pans
+ */
+void mouseButton(int button, int state, int x, int y) {
+	y = windowHeight - 1 - y; // GLUT counts from the top
+	if (state == GLUT_DOWN && (button == 3 || button == 4)) { // wheel
+		zoomView(button == 3 ? 1.25f : 0.8f, x, y);
+		return;
+	}
+	if (button == GLUT_LEFT_BUTTON) {
+		dragX = (state == GLUT_DOWN) ? x : -1;
+		dragY = y;
+	}
+}
+
+void mouseDrag(int x, int y) {
+	y = windowHeight - 1 - y;
+	if (dragX < 0) { return; }
+	viewX -= (x - dragX) / viewZoom;
+	viewY -= (y - dragY) / viewZoom;
+	dragX = x;
+	dragY = y;
+	glutPostRedisplay();
+}
+
+/**
+* Copy Image function
+* make a copy from Image A to Image B
+*
+* @param i - the image to copy
+* @return - a copy of that image
+*/
+Image copyImage(Image img) {
+	PROFILE_SCOPE("copyImage", 0, (size_t)img.width * img.height);
+	Image tempImage; // create temporary image
+	// copy dimensions over
+	tempImage.height = img.height;
+	tempImage.width = img.width;
+	tempImage.bitmap = NULL; // the copy always owns its pixels
+	tempImage.mapping = NULL;
+	// allocate memory for next pixel data
+	tempImage.data = (Pixel*)malloc(sizeof(Pixel)*img.width*img.height);
+	PROFILE_ALLOC(sizeof(Pixel)*img.width*img.height);
+	// copy memory from i to return image
+	memcpy(tempImage.data, img.data, sizeof(Pixel)*img.width*img.height);
+	return tempImage; // return the copy
+}
+
+/**
+ * Menu Display function
+ * displays CLI menu to user
+ */
+void printMenu() {
+	cout << "Q: Quit\tR: Reset\t S: Save\tEsc: Cancel" << endl;
+	cout << "U: Undo\tY: Redo" << endl;
+	cout << "+/-, wheel: Zoom\tarrows, drag: Pan\tZ: Fit" << endl;
+#ifdef PROFILE
+	cout << "P: Profile so far" << endl;
+#endif
+	cout << "\nDisplay" << endl;
+	cout << "1: Greyscale\t2: NTSC\t3: Monochrome\t4: Channel Swap" << endl;
+	cout << "5: Pure R\t6: Pure G\t7: Pure B" << endl;
+	cout << "\nBasic Channel Filters" << endl;
+	cout << "8: Max\t9: Min\t0: Int R\ta: Int G\tb: Int B" << endl;
+	cout << "\nConvolution Filters" << endl;
+	cout << "c: GS Edges\td: Color Edges" << endl;
+	cout << "e: Blur\tf: Gauss. Blur\tg: Sharpen" << endl;
+	cout << "\nSmoothing Filters" << endl;
+	cout << "n: Box Blur\to: Median (--smooth-radius)" << endl;
+	cout << "\nQuantize Filters" << endl;
+	cout << "h: Fixed RGB\ti: Random RGB\tm: Median Cut (--colors)" << endl;
+	cout << "\nCustom Filters" << endl;
+	cout << "j: Image Negative\tk: Sepia Filter" << endl;
+	cout << "l: Custom Kernel (--kernel)" << endl;
+}
+// every key applyFilter() knows, and those taking an argument
+#define FILTER_KEYS "1234567890abcdefghijklmno"
+#define ARG_KEYS "89ilmno"
+
+/**
+ * Apply Filter function
+ * runs the filter bound to a menu key on an image, shared by
+ * the GLUT menu and the headless batch mode
+ *
+ * @param img - the image to work with
+ * @param key - the menu key of the filter
+ * @param arg - the key's argument in a pipeline, NULL for defaults
+ * @return - whether the key names a filter
+ */
+bool applyFilter(Image &img, unsigned char key, const char *arg = NULL) {
+	switch (key) {
+	case '1': { changeGrey(img, 'G'); break; }
+	case '2': { changeGrey(img, 'N'); break; }
+	case '3': { changeMonochrome(img); break; }
+	case '4': { changeSwap(img); break; }
+	case '5': { changeSingleChannel(img, 'R'); break; }
+	case '6': { changeSingleChannel(img, 'G'); break; }
+	case '7': { changeSingleChannel(img, 'B'); break; }
+	case '8': { changeMax(img, arg ? atoi(arg) : morphRadius); break; }
+	case '9': { changeMin(img, arg ? atoi(arg) : morphRadius); break; }
+	case '0': { changeIntensity(img, 'R'); break; }
+	case 'a': { changeIntensity(img, 'G'); break; }
+	case 'b': { changeIntensity(img, 'B'); break; }
+	case 'c': { bothEdges(img, 'N'); break; }
+	case 'd': { bothEdges(img, 'C'); break; }
+	case 'e': { changeConvolution(img, 'C'); break; }
+	case 'f': { changeConvolution(img, 'G'); break; }
+	case 'g': { changeConvolution(img, 'S'); break; }
+	case 'h': { changeQuantize(img, 'F'); break; }
+	case 'i': { // i:colours:seed, either may be left out
+		const char *seed = (arg != NULL) ? strchr(arg, ':') : NULL;
+		changeQuantize(img, 'R', (arg != NULL && *arg != ':') ? atoi(arg) : 9, seed ? strtoul(seed + 1, NULL, 10) : 0);
+		break;
+	}
+	case 'j': { changeNegative(img); break; }
+	case 'k': { changeSepia(img); break; }
+	case 'l': { return applyKernel(img, arg); }
+	case 'm': { changeQuantize(img, 'M', arg ? atoi(arg) : paletteColors); break; }
+	case 'n': { changeBoxBlur(img, arg ? atoi(arg) : smoothRadius); break; }
+	case 'o': { changeMedian(img, arg ? atoi(arg) : smoothRadius); break; }
+	default: { return false; }
+	}
+	return true;
+}
+
+/**
+ * Menu Handler function
+ * Glut needs argument for menu to perform operations
+ * on image. The CLI menu serves as instruction for this
+ * switch statement
+ */
+void menu(unsigned char key, int x, int y) {
+	PROFILE_SCOPE("menu", key, (size_t)workBuffer.width * workBuffer.height);
+	switch (key) {
+	case 'q': { exit(0); break; }
+#ifdef PROFILE
+	case 'p': { profileSummary(); break; }
+#endif
+	case 'r': { queueFilter('r'); break; } // copied back over by the worker
+	case 's': { queueFilter('s'); break; } // the chain so far, at full size
+	case 27: { cancelFilters(); break; } // escape
+	case 'u': case 26: { queueFilter('u'); break; } // or ctrl+z
+	case 'y': case 25: { queueFilter('y'); break; } // or ctrl+y
+	case 'z': { fitView(); break; }
+	case '+': case '=': { zoomView(2, windowWidth / 2, windowHeight / 2); break; }
+	case '-': { zoomView(0.5f, windowWidth / 2, windowHeight / 2); break; }
+	default: {
+		if (key != 0 && strchr(FILTER_KEYS, key) != NULL) { queueFilter(key); }
+	}
+	}
+}
+
+/**
+ * Pointwise Filter function
+ * looks up the span form of a menu key's filter, for keys whose
+ * filter only ever looks at one pixel at a time
+ *
+ * @param key - the menu key
+ * @param fn - receives the span filter
+ * @param type - receives the type argument for fn
+ * @return - whether the key is pointwise
+ */
+bool pointwiseFilter(char key, SpanFn &fn, char &type) {
+	type = 0;
+	switch (key) {
+	case '1': { type = 'G'; fn = greySpanFor(type); break; }
+	case '2': { type = 'N'; fn = greySpanFor(type); break; }
+	case '3': { fn = monochromeSpanFor(); break; }
+	case '4': { fn = swapSpan; break; }
+	case '5': { type = 'R'; fn = singleChannelSpanFor(type); break; }
+	case '6': { type = 'G'; fn = singleChannelSpanFor(type); break; }
+	case '7': { type = 'B'; fn = singleChannelSpanFor(type); break; }
+	case '0': { type = 'R'; fn = intensitySpanFor(type); break; }
+	case 'a': { type = 'G'; fn = intensitySpanFor(type); break; }
+	case 'b': { type = 'B'; fn = intensitySpanFor(type); break; }
+	case 'j': { fn = negativeSpan; break; }
+	case 'k': { fn = sepiaSpanFor(); break; }
+	default: { return false; }
+	}
+	return true;
+}
+
+/**
+ * Channel Map
+ * a pointwise filter that handles channels independently: output
+ * channel c is lut[c] of input channel source[c]. Any run of these
+ * composes into one map with no change to the output at all
+ */
+typedef struct {
+	int source[3];
+	GLubyte lut[3][256];
+} ChannelMap;
+
+/**
+ * Channel Map For function
+ * builds the channel map of a menu key's filter. The tables come
+ * from running the filter itself over grey probe pixels, so they
+ * can never drift from the filter
+ *
+ * @param key - the menu key
+ * @param map - receives the map
+ * @return - whether the key's filter is channel independent
+ */
+bool channelMapFor(char key, ChannelMap &map) {
+	SpanFn fn;
+	char type;
+	if (strchr("4567ab0j", key) == NULL || !pointwiseFilter(key, fn, type)) {
+		return false;
+	}
+	for (int c = 0; c < 3; c++) {
+		map.source[c] = (key == '4') ? (c + 1) % 3 : c; // swap reads the next channel
+	}
+	Pixel probe[256];
+	for (int v = 0; v < 256; v++) {
+		probe[v].red = probe[v].green = probe[v].blue = v;
+	}
+	fn(probe, 256, type);
+	for (int v = 0; v < 256; v++) {
+		map.lut[0][v] = probe[v].red;
+		map.lut[1][v] = probe[v].green;
+		map.lut[2][v] = probe[v].blue;
+	}
+	return true;
+}
+
+/**
+ * Compose Maps function
+ * folds map b, applied after map a, into a
+ */
+void composeMaps(ChannelMap &a, const ChannelMap &b) {
+	ChannelMap both;
+	for (int c = 0; c < 3; c++) {
+		both.source[c] = a.source[b.source[c]];
+		for (int v = 0; v < 256; v++) {
+			both.lut[c][v] = b.lut[c][a.lut[b.source[c]][v]];
+		}
+	}
+	a = both;
+}
+
+/**
+ * Map Span function
+ * applies a channel map to n pixels
+ */
+void mapSpan(Pixel *p, int n, const ChannelMap &map) {
+	for (int k = 0; k < n; k++) {
+		GLubyte in[3] = { p[k].red, p[k].green, p[k].blue };
+		p[k].red = map.lut[0][in[map.source[0]]];
+		p[k].green = map.lut[1][in[map.source[1]]];
+		p[k].blue = map.lut[2][in[map.source[2]]];
+	}
+}
+
+/**
+ * Planes type
+ * the planar layout: each channel in a plane of its own, rows
+ * padded to a multiple of PLANE_ALIGN bytes and every plane
+ * aligned to it, so row starts suit aligned vector loads and a
+ * filter working on one channel touches only that plane. Images
+ * stay interleaved at the I/O and display boundaries; runs of
+ * pipeline stages that have planar versions convert once on the
+ * way in and once on the way out (--planar)
+ */
+#define PLANE_ALIGN 64
+typedef struct {
+	GLubyte *plane[3]; // red, green, blue
+	GLubyte *spare[3]; // out of place results, swapped with plane, NULL until needed
+	int width, height;
+	int stride; // bytes from one row to the next
+} Planes;
+
+// run planar capable pipeline stages on planes (--planar)
+bool planarMode = false;
+
+/**
+ * Plane Alloc function
+ * one aligned, padded plane
+ */
+GLubyte *planeAlloc(const Planes &planes) {
+	size_t bytes = (size_t)planes.stride * max(planes.height, 1);
+	PROFILE_ALLOC(bytes);
+	return (GLubyte*)aligned_alloc(PLANE_ALIGN, bytes);
+}
+
+void freePlanes(Planes &planes) {
+	for (int c = 0; c < 3; c++) {
+		free(planes.plane[c]);
+		free(planes.spare[c]);
+		planes.plane[c] = planes.spare[c] = NULL;
+	}
+}
+
+/**
+ * Split Row function
+ * deinterleaves a row of RGB bytes into three plane rows
+ */
+void splitRowScalar(GLubyte **out, const GLubyte *in, int width) {
+	for (int j = 0; j < width; j++, in += 3) {
+		out[0][j] = in[0];
+		out[1][j] = in[1];
+		out[2][j] = in[2];
+	}
+}
+
+/**
+ * Merge Row function
+ * interleaves three plane rows into a row of RGB bytes
+ */
+void mergeRowScalar(GLubyte *out, GLubyte *const *in, int width) {
+	for (int j = 0; j < width; j++, out += 3) {
+		out[0] = in[0][j];
+		out[1] = in[1][j];
+		out[2] = in[2][j];
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("ssse3")))
+void splitRowSSSE3(GLubyte **out, const GLubyte *in, int width) {
+	int j = 0;
+	for (; j + 16 <= width; j += 16, in += 48) {
+		__m128i plane[3];
+		splitPixels(in, plane);
+		for (int c = 0; c < 3; c++) { _mm_storeu_si128((__m128i*)(out[c] + j), plane[c]); }
+	}
+	GLubyte *rest[3] = { out[0] + j, out[1] + j, out[2] + j };
+	splitRowScalar(rest, in, width - j);
+}
+
+__attribute__((target("ssse3")))
+void mergeRowSSSE3(GLubyte *out, GLubyte *const *in, int width) {
+	int j = 0;
+	for (; j + 16 <= width; j += 16, out += 48) {
+		__m128i plane[3];
+		for (int c = 0; c < 3; c++) { plane[c] = _mm_loadu_si128((const __m128i*)(in[c] + j)); }
+		mergePixels(out, plane);
+	}
+	GLubyte *rest[3] = { in[0] + j, in[1] + j, in[2] + j };
+	mergeRowScalar(out, rest, width - j);
+}
+#endif
+
+void splitRow(GLubyte **out, const GLubyte *in, int width) {
+#ifdef HAVE_X86_SIMD
+	if (simdLevel() >= 1) {
+		splitRowSSSE3(out, in, width);
+		return;
+	}
+#endif
+	splitRowScalar(out, in, width);
+}
+
+void mergeRow(GLubyte *out, GLubyte *const *in, int width) {
+#ifdef HAVE_X86_SIMD
+	if (simdLevel() >= 1) {
+		mergeRowSSSE3(out, in, width);
+		return;
+	}
+#endif
+	mergeRowScalar(out, in, width);
+}
+
+/**
+ * Split Planes function
+ * converts an interleaved image to planes
+ *
+ * @param img - the image
+ * @param planes - receives the planes, free with freePlanes()
+ */
+void splitPlanes(const Image &img, Planes &planes) {
+	PROFILE_SCOPE("split planes", 0, (size_t)img.width * img.height);
+	planes.width = img.width;
+	planes.height = img.height;
+	planes.stride = (img.width + PLANE_ALIGN - 1) / PLANE_ALIGN * PLANE_ALIGN;
+	for (int c = 0; c < 3; c++) {
+		planes.plane[c] = planeAlloc(planes);
+		planes.spare[c] = NULL;
+	}
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			size_t at = (size_t)i * planes.stride;
+			GLubyte *out[3] = { planes.plane[0] + at, planes.plane[1] + at, planes.plane[2] + at };
+			splitRow(out, (const GLubyte*)(img.data + (size_t)i * img.width), img.width);
+		}
+	});
+}
+
+/**
+ * Merge Planes function
+ * converts planes back into an interleaved image of the same size
+ *
+ * @param planes - the planes
+ * @param img - the image to write
+ */
+void mergePlanes(const Planes &planes, Image &img) {
+	PROFILE_SCOPE("merge planes", 0, (size_t)img.width * img.height);
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			size_t at = (size_t)i * planes.stride;
+			GLubyte *in[3] = { planes.plane[0] + at, planes.plane[1] + at, planes.plane[2] + at };
+			mergeRow((GLubyte*)(img.data + (size_t)i * img.width), in, img.width);
+		}
+	});
+}
+
+/**
+ * Planar Map function
+ * applies a channel map to planes. A swap just trades plane
+ * pointers, a table that zeroes a channel clears its plane, and
+ * planes whose table is the identity aren't touched at all, so
+ * intensity and single channel filters only work on the planes
+ * they change
+ */
+void planarMap(Planes &planes, const ChannelMap &map) {
+	GLubyte *from[3] = { planes.plane[0], planes.plane[1], planes.plane[2] };
+	for (int c = 0; c < 3; c++) { planes.plane[c] = from[map.source[c]]; } // always a permutation
+	for (int c = 0; c < 3; c++) {
+		const GLubyte *lut = map.lut[c];
+		bool identity = true, zero = true;
+		for (int v = 0; v < 256; v++) {
+			identity = identity && lut[v] == v;
+			zero = zero && lut[v] == 0;
+		}
+		if (identity) { continue; }
+		GLubyte *plane = planes.plane[c];
+		parallelRows(planes.height, planes.width, [&](int begin, int end) {
+			GLubyte *p = plane + (size_t)begin * planes.stride;
+			size_t n = (size_t)(end - begin) * planes.stride;
+			if (zero) {
+				memset(p, 0, n);
+				return;
+			}
+			for (size_t k = 0; k < n; k++) { p[k] = lut[p[k]]; }
+		});
+	}
+}
+
+/**
+ * Convolve Plane Pixel function
+ * convolvePixel() for one pixel of one plane
+ */
+GLubyte convolvePlanePixel(const Planes &planes, const GLubyte *plane, const int *matrix, int i, int j) {
+	int l = 0, sum = 0;
+	for (int y = -1; y <= 1; y++) {
+		if (i + y < 0 || i + y >= planes.height) { continue; }
+		for (int x = -1; x <= 1; x++) {
+			if (j + x < 0 || j + x >= planes.width) { continue; }
+			int m = matrix[(y + 1) * 3 + x + 1];
+			l += m;
+			sum += plane[(size_t)(i + y) * planes.stride + j + x] * m;
+		}
+	}
+	return max(0, min(255, sum / max(l, 1)));
+}
+
+/**
+ * Planar Convolution function
+ * changeConvolution() on planes. The same interior row kernels
+ * run along a plane's rows with neighbours one byte apart, and all
+ * three planes are shared out as one job of 3*height rows
+ *
+ * @param planes - the planes to work with
+ * @param type - the type of kernel to use
+ */
+void planarConvolution(Planes &planes, char type) {
+	int m = convolutionIndex(type);
+	const int *matrix = fixedTaps[m].matrix;
+	ConvPlan plan;
+	planConvolution(plan, matrix, 1);
+	ConvRowFn interior = fixedKernel(m, plan);
+	int w = planes.width, h = planes.height;
+	for (int c = 0; c < 3; c++) {
+		if (planes.spare[c] == NULL) { planes.spare[c] = planeAlloc(planes); }
+	}
+	parallelRows(3 * h, w, [&](int begin, int end) {
+		for (int row = begin; row < end; row++) {
+			int c = row / h, i = row % h;
+			const GLubyte *src = planes.plane[c];
+			GLubyte *out = planes.spare[c] + (size_t)i * planes.stride;
+			if (i == 0 || i == h - 1 || w < 3) {
+				for (int j = 0; j < w; j++) { out[j] = convolvePlanePixel(planes, src, matrix, i, j); }
+				continue;
+			}
+			const GLubyte *rows[3] = {
+				src + (size_t)(i - 1) * planes.stride + 1,
+				src + (size_t)i * planes.stride + 1,
+				src + (size_t)(i + 1) * planes.stride + 1
+			};
+			out[0] = convolvePlanePixel(planes, src, matrix, i, 0);
+			interior(out + 1, rows, w - 2, plan);
+			out[w - 1] = convolvePlanePixel(planes, src, matrix, i, w - 1);
+		}
+	});
+	for (int c = 0; c < 3; c++) { std::swap(planes.plane[c], planes.spare[c]); }
+}
+
+/**
+ * Planar Morph function
+ * changeMorph() on planes: the row pass works a plane row at a
+ * time with one byte per pixel, the column pass down strips of
+ * each plane
+ *
+ * @param planes - the planes to work with
+ * @param radius - window radius
+ * @param takeMax - dilate if true, erode otherwise
+ */
+void planarMorph(Planes &planes, int radius, bool takeMax) {
+	if (radius <= 0) { return; }
+	int w = planes.width, h = planes.height, r = radius;
+	parallelRows(3 * h, w, [&](int begin, int end) {
+		size_t scratch = (size_t)w + 2 * r;
+		GLubyte *g = (GLubyte*)threadScratch(0, scratch), *hs = (GLubyte*)threadScratch(1, scratch);
+		for (int row = begin; row < end; row++) {
+			GLubyte *p = planes.plane[row / h] + (size_t)(row % h) * planes.stride;
+			if (takeMax) { morphRow<true, 1>(p, w, r, g, hs); }
+			else { morphRow<false, 1>(p, w, r, g, hs); }
+		}
+	});
+	int strips = (w + MORPH_STRIP - 1) / MORPH_STRIP;
+	parallelRows(3 * strips, h * MORPH_STRIP, [&](int begin, int end) {
+		size_t scratch = (size_t)MORPH_STRIP * (h + 2 * r);
+		GLubyte *g = (GLubyte*)threadScratch(0, scratch), *hs = (GLubyte*)threadScratch(1, scratch);
+		for (int s = begin; s < end; s++) {
+			int first = (s % strips) * MORPH_STRIP, bytes = min(MORPH_STRIP, w - first);
+			GLubyte *base = planes.plane[s / strips] + first;
+			if (takeMax) { morphColumns<true>(base, h, planes.stride, bytes, r, g, hs); }
+			else { morphColumns<false>(base, h, planes.stride, bytes, r, g, hs); }
+		}
+	});
+}
+
+/**
+ * Pipeline Stage
+ * one step of a compiled pipeline: a fused channel map, a
+ * pointwise span filter, or any other filter run by its menu key
+ */
+typedef struct {
+	char key; // menu key for whole image filters, 0 otherwise
+	const char *arg; // the key's argument, if it was given one
+	SpanFn fn; // pointwise filters that mix channels
+	char type;
+	ChannelMap *map; // runs of channel independent filters
+} Stage;
+
+typedef struct {
+	Stage *stages;
+	int count;
+	char *text; // copy of the spec the arguments point into
+} Pipeline;
+
+void freePipeline(Pipeline &pipe) {
+	for (int s = 0; s < pipe.count; s++) {
+		free(pipe.stages[s].map);
+	}
+	free(pipe.stages);
+	free(pipe.text);
+	pipe.stages = NULL;
+	pipe.text = NULL;
+	pipe.count = 0;
+}
+
+/**
+ * Compile Pipeline function
+ * parses a comma separated list of menu keys, eg. "2,f,g,k", into
+ * stages. Keys listed in ARG_KEYS may carry an argument after a
+ * colon, eg. "8:15" for a radius 15 maximum.
+ *
+ * Every run of channel independent filters (swap, single channel,
+ * intensity, negative) is folded into a single lookup table map.
+ * Greyscale, monochrome and sepia mix channels and truncate after
+ * every term, so folding them into one colour matrix would change
+ * their output; they stay separate stages but still share the
+ * memory pass, see runPointwise()
+ *
+ * @param spec - the pipeline as given on the command line
+ * @param pipe - receives the stages, free with freePipeline()
+ * @return - whether every entry names a filter
+ */
+bool compilePipeline(const char *spec, Pipeline &pipe) {
+	pipe.text = strdup(spec); // arguments point into this
+	pipe.stages = (Stage*)calloc(strlen(spec) + 1, sizeof(Stage));
+	pipe.count = 0;
+	ChannelMap map;
+	char *save = NULL;
+	bool valid = true;
+	for (char *tok = strtok_r(pipe.text, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+		char key = tok[0];
+		const char *arg = NULL;
+		if (strchr(FILTER_KEYS, key) == NULL) {
+			valid = false;
+			break;
+		}
+		if (tok[1] == ':' && tok[2] != '\0' && strchr(ARG_KEYS, key) != NULL) {
+			arg = tok + 2;
+		}
+		else if (tok[1] != '\0') { // every entry is exactly one menu key
+			valid = false;
+			break;
+		}
+		Stage &last = pipe.stages[max(pipe.count - 1, 0)];
+		Stage &next = pipe.stages[pipe.count];
+		if (arg == NULL && channelMapFor(key, map)) {
+			if (pipe.count > 0 && last.map != NULL) {
+				composeMaps(*last.map, map);
+				continue;
+			}
+			next.map = (ChannelMap*)malloc(sizeof(ChannelMap));
+			*next.map = map;
+		}
+		else if (arg != NULL || !pointwiseFilter(key, next.fn, next.type)) {
+			next.key = key;
+			next.arg = arg;
+		}
+		pipe.count++;
+	}
+	if (!valid) {
+		freePipeline(pipe);
+		return false;
+	}
+	return pipe.count > 0;
+}
+
+// pixels per block when fused stages run back to back, fits in L1
+#define FUSE_BLOCK 1024
+
+/**
+ * Run Pointwise function
+ * runs consecutive pointwise stages as one pass over the image:
+ * each block of pixels goes through every stage while it is still
+ * in cache, so N stages cost one trip through memory instead of N
+ *
+ * @param img - the image to work with
+ * @param stages - the first stage
+ * @param count - how many pointwise stages follow
+ */
+void runPointwise(Image &img, const Stage *stages, int count) {
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		Pixel *p = img.data + (size_t)begin*img.width;
+		int n = (end - begin)*img.width;
+		for (int done = 0; done < n; done += FUSE_BLOCK) {
+			int len = min(FUSE_BLOCK, n - done);
+			for (int s = 0; s < count; s++) {
+				if (stages[s].map != NULL) {
+					mapSpan(p + done, len, *stages[s].map);
+				}
+				else {
+					stages[s].fn(p + done, len, stages[s].type);
+				}
+			}
+		}
+	});
+}
+
+/**
+ * Planar Stage function
+ * runs a stage on planes if it has a planar version: channel maps,
+ * convolutions (e, f, g) and morphology (8, 9)
+ *
+ * @param planes - the planes to work with, NULL to only ask
+ * @param stage - the stage
+ * @return - whether the stage has a planar version
+ */
+bool planarStage(Planes *planes, const Stage &stage) {
+	if (stage.map != NULL) {
+		if (planes != NULL) { planarMap(*planes, *stage.map); }
+		return true;
+	}
+	if (stage.key == 0 || strchr("efg89", stage.key) == NULL) { return false; }
+	if (planes == NULL) { return true; }
+	if (stage.key == '8' || stage.key == '9') {
+		planarMorph(*planes, stage.arg ? atoi(stage.arg) : morphRadius, stage.key == '8');
+	}
+	else {
+		planarConvolution(*planes, (stage.key == 'e') ? 'C' : (stage.key == 'f') ? 'G' : 'S');
+	}
+	return true;
+}
+
+// set by Esc to stop the filters the worker is running at the next stage
+static std::atomic<bool> cancelRunning(false);
+
+/**
+ * Run Pipeline function
+ * applies a compiled pipeline to an image. With --planar, each run
+ * of stages that have planar versions and include a neighbourhood
+ * filter splits the image into planes once and merges it back once
+ *
+ * @param img - the image to work with
+ * @param pipe - the compiled pipeline
+ * @return - false if a stage could not run, eg. a missing kernel,
+ * or the run was cancelled part way
+ */
+bool runPipeline(Image &img, const Pipeline &pipe) {
+	bool ok = true;
+	for (int s = 0; s < pipe.count;) {
+		if (cancelRunning.load(std::memory_order_relaxed)) { return false; }
+		int planar = s;
+		bool neighbours = false; // maps alone are cheaper fused in place
+		while (planarMode && planar < pipe.count && planarStage(NULL, pipe.stages[planar])) {
+			neighbours = neighbours || pipe.stages[planar].key != 0;
+			planar++;
+		}
+		if (neighbours) {
+			Planes planes;
+			splitPlanes(img, planes);
+			for (; s < planar; s++) {
+				PROFILE_SCOPE("stage planar", pipe.stages[s].key, (size_t)img.width * img.height);
+				planarStage(&planes, pipe.stages[s]);
+			}
+			mergePlanes(planes, img);
+			freePlanes(planes);
+			continue;
+		}
+		if (pipe.stages[s].key != 0) {
+			PROFILE_SCOPE("stage", pipe.stages[s].key, (size_t)img.width * img.height);
+			ok = applyFilter(img, pipe.stages[s].key, pipe.stages[s].arg) && ok;
+			s++;
+			continue;
+		}
+		int run = s;
+		while (run < pipe.count && pipe.stages[run].key == 0) { run++; }
+		PROFILE_SCOPE("stage fused", 0, (size_t)img.width * img.height);
+		runPointwise(img, pipe.stages + s, run - s);
+		s = run;
+	}
+	return ok;
+}
+
+/**
+ * Result Cache state
+ * every image a chain of filters produced, keyed by a hash of the
+ * image the chain started from and the chain itself as a normalized
+ * pipeline ("2,f,g"). Chains are the paths of a DAG rooted at the
+ * source: "2,f,g" and "2,f,c" share the node "2,f", so whichever
+ * is evaluated second starts from the cached "2,f" and runs one
+ * filter. Only results worth keeping are stored, after each filter
+ * that isn't pointwise and at the end of a chain; the least recently
+ * used are dropped to stay within the budget (--result-cache-mb).
+ * Nothing at or past a random quantize (i) without a seed is
+ * cached, as it picks a new palette every run. Batch filter workers share it, so every
+ * access holds resultLock
+ */
+typedef struct {
+	uint64_t source; // hash of the image the chain starts from
+	char *chain; // normalized pipeline
+	Image img;
+	uint64_t used; // tick of the last lookup or store
+} CachedResult;
+static CachedResult *results = NULL;
+static int resultCount = 0, resultSize = 0;
+static size_t resultBytes = 0;
+static uint64_t resultTick = 0;
+static pthread_mutex_t resultLock = PTHREAD_MUTEX_INITIALIZER;
+size_t resultBudget = (size_t)256 << 20;
+
+/**
+ * Image Hash function
+ * a 64 bit hash of an image's pixels and size, each band of rows
+ * hashed on its own thread then combined in order
+ *
+ * @param img - the image
+ * @return - the hash
+ */
+uint64_t imageHash(const Image &img) {
+	const int BAND = 64; // rows per partial hash
+	int bands = (img.height + BAND - 1) / BAND;
+	uint64_t *part = (uint64_t*)calloc(max(bands, 1), sizeof(uint64_t));
+	parallelRows(bands, img.width * BAND, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			const GLubyte *p = (const GLubyte*)(img.data + (size_t)b * BAND * img.width);
+			size_t n = sizeof(Pixel) * img.width * min(BAND, img.height - b * BAND), k = 0;
+			uint64_t h = 0x9E3779B97F4A7C15ull ^ b, word;
+			for (; k + 8 <= n; k += 8) {
+				memcpy(&word, p + k, 8);
+				h = (h ^ word) * 0x100000001B3ull;
+				h ^= h >> 29;
+			}
+			for (; k < n; k++) { h = (h ^ p[k]) * 0x100000001B3ull; }
+			part[b] = h;
+		}
+	});
+	uint64_t hash = ((uint64_t)img.width << 32) ^ img.height;
+	for (int b = 0; b < bands; b++) { hash = (hash ^ part[b]) * 0x9E3779B97F4A7C15ull; }
+	free(part);
+	return hash ^ (hash >> 31);
+}
+
+/**
+ * Normalize Spec function
+ * rewrites a pipeline with its keys joined by single commas, the
+ * form chains are cached under
+ *
+ * @param spec - the pipeline as given
+ * @return - the normalized copy, to free
+ */
+char *normalizeSpec(const char *spec) {
+	char *text = strdup(spec), *chain = (char*)malloc(strlen(spec) + 1), *save = NULL;
+	int n = 0;
+	for (char *tok = strtok_r(text, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+		n += sprintf(chain + n, n > 0 ? ",%s" : "%s", tok);
+	}
+	chain[n] = '\0';
+	free(text);
+	return chain;
+}
+
+/**
+ * Cacheable Length function
+ * how much of a chain may be cached, everything before its first
+ * random quantize (i) without a seed, "i:colours:seed"
+ *
+ * @param chain - normalized pipeline
+ * @return - length of that prefix, without its trailing comma
+ */
+size_t cacheableLength(const char *chain) {
+	size_t at = 0;
+	while (chain[at] != '\0') {
+		size_t start = at;
+		int colons = 0;
+		while (chain[at] != '\0' && chain[at] != ',') { colons += (chain[at++] == ':'); }
+		if (chain[start] == 'i' && colons < 2) { return (start > 0) ? start - 1 : 0; }
+		at += (chain[at] == ',');
+	}
+	return at;
+}
+
+/**
+ * Find Result function
+ * the longest cached prefix of a chain, ending at a comma. Call
+ * with resultLock held, the entry may go once it is released
+ *
+ * @param source - hash of the image the chain starts from
+ * @param chain - normalized pipeline
+ * @param longer - only prefixes longer than this count
+ * @return - the entry, or NULL
+ */
+CachedResult *findResult(uint64_t source, const char *chain, size_t longer) {
+	CachedResult *best = NULL;
+	size_t bestLength = longer, limit = cacheableLength(chain);
+	for (int r = 0; r < resultCount; r++) {
+		size_t length = strlen(results[r].chain);
+		if (results[r].source == source && length > bestLength && length <= limit && strncmp(results[r].chain, chain, length) == 0
+			&& (chain[length] == ',' || chain[length] == '\0')) {
+			best = results + r;
+			bestLength = length;
+		}
+	}
+	if (best != NULL) { best->used = ++resultTick; }
+	return best;
+}
+
+/**
+ * Drop Result function
+ * frees one entry and closes the gap
+ */
+void dropResult(int r) {
+	resultBytes -= sizeof(Pixel) * results[r].img.width * results[r].img.height;
+	free(results[r].img.data);
+	free(results[r].chain);
+	results[r] = results[--resultCount];
+}
+
+/**
+ * Store Result function
+ * caches a copy of the image a prefix of a chain produced,
+ * dropping the least recently used entries to make room
+ *
+ * @param source - hash of the image the chain starts from
+ * @param chain - normalized pipeline
+ * @param length - how much of chain produced img
+ * @param img - the result
+ */
+void storeResult(uint64_t source, const char *chain, size_t length, const Image &img) {
+	size_t bytes = sizeof(Pixel) * img.width * img.height;
+	if (bytes > resultBudget || length > cacheableLength(chain)) { return; }
+	pthread_mutex_lock(&resultLock);
+	for (int r = 0; r < resultCount; r++) {
+		if (results[r].source == source && strlen(results[r].chain) == length && strncmp(results[r].chain, chain, length) == 0) {
+			results[r].used = ++resultTick;
+			pthread_mutex_unlock(&resultLock);
+			return;
+		}
+	}
+	while (resultBytes + bytes > resultBudget) {
+		int oldest = 0;
+		for (int r = 1; r < resultCount; r++) {
+			if (results[r].used < results[oldest].used) { oldest = r; }
+		}
+		dropResult(oldest);
+	}
+	if (resultCount == resultSize) {
+		resultSize = max(16, resultSize * 2);
+		results = (CachedResult*)realloc(results, sizeof(CachedResult) * resultSize);
+	}
+	CachedResult &entry = results[resultCount++];
+	entry.source = source;
+	entry.chain = strndup(chain, length);
+	entry.img = copyImage(img);
+	entry.used = ++resultTick;
+	resultBytes += bytes;
+	pthread_mutex_unlock(&resultLock);
+}
+
+/**
+ * Drop Results function
+ * forgets everything cached for one source image
+ */
+void dropResults(uint64_t source) {
+	pthread_mutex_lock(&resultLock);
+	for (int r = resultCount; r-- > 0;) {
+		if (results[r].source == source) { dropResult(r); }
+	}
+	pthread_mutex_unlock(&resultLock);
+}
+
+/**
+ * Run Chain Span function
+ * runs the keys chain[from, end) as one pipeline
+ */
+bool runChainSpan(Image &img, const char *chain, size_t from, size_t end) {
+	char *spec = strndup(chain + from, end - from);
+	Pipeline pipe;
+	bool ok = compilePipeline(spec, pipe);
+	if (ok) {
+		ok = runPipeline(img, pipe);
+		freePipeline(pipe);
+	}
+	free(spec);
+	return ok;
+}
+
+/**
+ * Evaluate Chain function
+ * brings an image from a prefix of a chain to the whole chain,
+ * starting from the longest longer prefix already cached. Runs of
+ * pointwise keys still fuse into one pass; every other key is a
+ * node whose result is cached on the way
+ *
+ * @param img - holds the result of the first done characters of chain
+ * @param source - hash of the image the chain starts from
+ * @param chain - normalized pipeline
+ * @param done - length of the prefix img already holds
+ * @return - false if a stage could not run or was cancelled
+ */
+bool evaluateChain(Image &img, uint64_t source, const char *chain, size_t done) {
+	size_t length = strlen(chain);
+	pthread_mutex_lock(&resultLock);
+	CachedResult *hit = findResult(source, chain, done);
+	if (hit != NULL) {
+		memcpy(img.data, hit->img.data, sizeof(Pixel) * img.width * img.height);
+		done = strlen(hit->chain);
+	}
+	pthread_mutex_unlock(&resultLock);
+	bool ok = true;
+	size_t from = done + (chain[done] == ','); // the keys not run yet
+	for (size_t at = from; at < length;) {
+		if (cancelRunning.load(std::memory_order_relaxed)) { return false; }
+		size_t end = at;
+		while (chain[end] != '\0' && chain[end] != ',') { end++; }
+		ChannelMap map;
+		SpanFn fn;
+		char type;
+		bool pointwise = (end == at + 1 && (channelMapFor(chain[at], map) || pointwiseFilter(chain[at], fn, type)));
+		if (!pointwise) {
+			if (runChainSpan(img, chain, from, end)) { storeResult(source, chain, end, img); }
+			else { ok = false; }
+			from = end + 1;
+		}
+		at = end + 1;
+	}
+	if (from < length) {
+		if (runChainSpan(img, chain, from, length)) { storeResult(source, chain, length, img); }
+		else { ok = false; }
+	}
+	return ok;
+}
+
+/**
+ * Preview Pyramid
+ * saveBuffer halved again and again at load, each level the mean of
+ * 2x2 pixels of the one above. Interactive filters run on the level
+ * whose pixels are just finer than the screen's at the current
+ * zoom, so a keypress costs about a window's worth of pixels however
+ * large the image is. Zooming in reruns the chain on a finer level,
+ * and saving runs it on the full image, which is level 0. Filters
+ * with a neighbourhood cover more of the image per pixel on a
+ * coarser level, so their previews are approximate
+ */
+#define PREVIEW_LEVELS 8
+#define PREVIEW_MIN 256 // levels stop once the longer side fits this
+static Image previewLevels[PREVIEW_LEVELS];
+static uint64_t previewHash[PREVIEW_LEVELS]; // keys each level's results in the cache
+static int previewCount = 1;
+static int previewLevel = 0; // the level the view wants, set by the GLUT thread
+static int workLevel = 0; // the level workBuffer and the history are at, the worker's
+
+// whether interactive filters run on preview levels (--no-preview)
+bool previewMode = true;
+
+/**
+ * Halve Image function
+ * the next pyramid level, each pixel the rounded mean of a 2x2
+ * block. An odd last row or column is averaged with itself
+ *
+ * @param src - the level above
+ * @return - the new level
+ */
+Image halveImage(const Image &src) {
+	Image half;
+	half.width = (src.width + 1) / 2;
+	half.height = (src.height + 1) / 2;
+	half.bitmap = NULL;
+	half.mapping = NULL;
+	half.data = (Pixel*)malloc(sizeof(Pixel) * half.width * half.height);
+	PROFILE_ALLOC(sizeof(Pixel) * half.width * half.height);
+	parallelRows(half.height, half.width, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			const GLubyte *top = (const GLubyte*)(src.data + (size_t)(2 * i) * src.width);
+			const GLubyte *bottom = (const GLubyte*)(src.data + (size_t)min(2 * i + 1, src.height - 1) * src.width);
+			GLubyte *out = (GLubyte*)(half.data + (size_t)i * half.width);
+			for (int j = 0; j < half.width; j++) {
+				int a = 6 * j, b = 3 * min(2 * j + 1, src.width - 1); // left and right bytes
+				for (int c = 0; c < 3; c++) {
+					out[3 * j + c] = (top[a + c] + top[b + c] + bottom[a + c] + bottom[b + c] + 2) / 4;
+				}
+			}
+		}
+	});
+	return half;
+}
+
+/**
+ * Build Preview function
+ * makes the pyramid from saveBuffer, once it is loaded
+ */
+void buildPreview() {
+	PROFILE_SCOPE("build preview", 0, (size_t)saveBuffer.width * saveBuffer.height);
+	previewLevels[0] = saveBuffer;
+	previewHash[0] = imageHash(saveBuffer);
+	previewCount = 1;
+	while (previewCount < PREVIEW_LEVELS) {
+		const Image &last = previewLevels[previewCount - 1];
+		if (max(last.width, last.height) <= PREVIEW_MIN) { break; }
+		previewLevels[previewCount] = halveImage(last);
+		previewHash[previewCount] = imageHash(previewLevels[previewCount]);
+		previewCount++;
+	}
+}
+
+/**
+ * History state
+ * every key the worker runs becomes one undo step, even when a
+ * burst of keys ran as one batch. Keys with an exact inverse
+ * (negative, channel swap) store just the key and are undone by
+ * running the inverse. Anything else stores the XOR of the image
+ * before and after, run length coded in bands of rows so unchanged
+ * stretches cost almost nothing; XORing it back in undoes the step
+ * and again redoes it. Steps without a delta replay from their
+ * chains instead: the keys inside a burst, whose images in between
+ * were never made, the oldest steps, whose deltas are dropped to
+ * keep within the history budget (--history-mb), and every step
+ * once the worker moves to another preview level, where the deltas
+ * no longer fit. Each random quantize (i) gets a seed as the worker
+ * takes it, so its chain replays the palette the user saw
+ */
+#define HISTORY_BAND 32 // rows per delta band
+typedef struct {
+	char *keys; // the key that ran
+	char *inverse; // pipeline that undoes it, NULL to use the delta
+	GLubyte **bands; // coded delta per band of rows
+	size_t *bandBytes;
+	int bandCount;
+	size_t bytes; // memory the delta takes
+	char *before, *after; // the chain since the last reset, either side
+} HistoryStep;
+static HistoryStep *history = NULL;
+static int historyCount = 0, historySize = 0;
+static int historyAt = 0; // steps applied, those after it can be redone
+static size_t historyBytes = 0;
+size_t historyBudget = (size_t)256 << 20;
+
+/**
+ * Pack Delta function
+ * codes the XOR of two runs of bytes as pairs of counts, zeros to
+ * skip then bytes to XOR, each followed by those bytes. Zero runs
+ * under 9 bytes aren't worth a pair and stay in with the literals,
+ * which bounds the output to n + 16 bytes
+ *
+ * @param before - the old bytes
+ * @param after - the new bytes
+ * @param n - how many
+ * @param out - at least n + 16 bytes
+ * @return - bytes written
+ */
+size_t packDelta(const GLubyte *before, const GLubyte *after, size_t n, GLubyte *out) {
+	size_t used = 0, k = 0;
+	while (k < n) {
+		size_t start = k, same = 0;
+		while (k < n && before[k] == after[k]) { k++; }
+		uint32_t zeros = k - start;
+		for (start = k; k < n; k++) { // up to the next 9 equal bytes
+			same = (before[k] == after[k]) ? same + 1 : 0;
+			if (same == 9) {
+				k -= 8;
+				break;
+			}
+		}
+		uint32_t literals = k - start;
+		memcpy(out + used, &zeros, 4);
+		memcpy(out + used + 4, &literals, 4);
+		used += 8;
+		for (size_t b = start; b < k; b++) { out[used++] = before[b] ^ after[b]; }
+	}
+	return used;
+}
+
+/**
+ * Apply Delta function
+ * XORs a packed delta into bytes, turning either side into the
+ * other
+ */
+void applyDelta(GLubyte *bytes, const GLubyte *packed, size_t size) {
+	for (size_t p = 0; p < size;) {
+		uint32_t zeros, literals;
+		memcpy(&zeros, packed + p, 4);
+		memcpy(&literals, packed + p + 4, 4);
+		p += 8;
+		bytes += zeros;
+		for (uint32_t b = 0; b < literals; b++) { *bytes++ ^= packed[p++]; }
+	}
+}
+
+/**
+ * Inverse Keys function
+ * the pipeline undoing one, when every key has an exact inverse
+ *
+ * @param keys - the pipeline that ran
+ * @return - its inverse, to free, or NULL if there is none
+ */
+char *inverseKeys(const char *keys) {
+	size_t n = strlen(keys);
+	char *inverse = (char*)malloc(2 * n + 2), *out = inverse;
+	for (const char *k = keys + n; k-- > keys;) {
+		if (*k == ',') { continue; }
+		if (*k == 'j') { out += sprintf(out, "j,"); } // its own inverse
+		else if (*k == '4') { out += sprintf(out, "4,4,"); } // rotates, so twice more
+		else {
+			free(inverse);
+			return NULL;
+		}
+	}
+	out[-1] = '\0';
+	return inverse;
+}
+
+/**
+ * Free Step function
+ * releases one history step's memory
+ */
+void freeStep(HistoryStep &step) {
+	for (int b = 0; b < step.bandCount; b++) { free(step.bands[b]); }
+	free(step.bands);
+	free(step.bandBytes);
+	free(step.keys);
+	free(step.inverse);
+	free(step.before);
+	free(step.after);
+}
+
+/**
+ * Make Step function
+ * records what a key did, as its inverse or as a delta
+ *
+ * @param keys - the key that ran
+ * @param before - the image before, NULL to replay from the chains
+ * @param after - the image after
+ * @return - the step, its chains still to fill in
+ */
+HistoryStep makeStep(const char *keys, const Image *before, const Image &after) {
+	HistoryStep step;
+	memset(&step, 0, sizeof(step));
+	step.keys = strdup(keys);
+	step.inverse = inverseKeys(keys);
+	if (step.inverse != NULL || before == NULL) { return step; }
+	int w = before->width, h = before->height;
+	step.bandCount = (h + HISTORY_BAND - 1) / HISTORY_BAND;
+	step.bands = (GLubyte**)calloc(step.bandCount, sizeof(GLubyte*));
+	step.bandBytes = (size_t*)calloc(step.bandCount, sizeof(size_t));
+	parallelRows(step.bandCount, w * HISTORY_BAND, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			size_t first = (size_t)b * HISTORY_BAND * w, n = sizeof(Pixel) * w * min(HISTORY_BAND, h - b * HISTORY_BAND);
+			GLubyte *packed = (GLubyte*)threadScratch(0, n + 16);
+			step.bandBytes[b] = packDelta((const GLubyte*)(before->data + first), (const GLubyte*)(after.data + first),
+				n, packed);
+			step.bands[b] = (GLubyte*)malloc(step.bandBytes[b]);
+			memcpy(step.bands[b], packed, step.bandBytes[b]);
+		}
+	});
+	for (int b = 0; b < step.bandCount; b++) { step.bytes += step.bandBytes[b]; }
+	return step;
+}
+
+/**
+ * Replay Step function
+ * undoes a step, or redoes one already undone
+ *
+ * @param img - the image to change
+ * @param step - the step
+ * @param undo - undo rather than redo
+ */
+void replayStep(Image &img, const HistoryStep &step, bool undo) {
+	if (step.inverse != NULL) {
+		Pipeline pipe;
+		if (compilePipeline(undo ? step.inverse : step.keys, pipe)) {
+			runPipeline(img, pipe);
+			freePipeline(pipe);
+		}
+		return;
+	}
+	if (step.bands == NULL) { // its delta was made on another level, run its chain here
+		const Image &level = previewLevels[workLevel];
+		memcpy(img.data, level.data, sizeof(Pixel) * level.width * level.height);
+		evaluateChain(img, previewHash[workLevel], undo ? step.before : step.after, 0);
+		return;
+	}
+	parallelRows(step.bandCount, img.width * HISTORY_BAND, [&](int begin, int end) {
+		for (int b = begin; b < end; b++) {
+			applyDelta((GLubyte*)(img.data + (size_t)b * HISTORY_BAND * img.width), step.bands[b], step.bandBytes[b]);
+		}
+	});
+}
+
+/**
+ * Drop Delta function
+ * frees a step's delta, leaving it to replay from its chains
+ */
+void dropDelta(HistoryStep &step) {
+	for (int b = 0; b < step.bandCount; b++) { free(step.bands[b]); }
+	free(step.bands);
+	free(step.bandBytes);
+	step.bands = NULL;
+	step.bandBytes = NULL;
+	step.bandCount = 0;
+	historyBytes -= step.bytes;
+	step.bytes = 0;
+}
+
+/**
+ * Push Step function
+ * adds a step after the current one, forgetting anything that
+ * could have been redone, then drops the oldest deltas until the
+ * rest fit the budget. The steps stay, replaying from their chains
+ */
+void pushStep(const HistoryStep &step) {
+	while (historyCount > historyAt) {
+		historyBytes -= history[--historyCount].bytes;
+		freeStep(history[historyCount]);
+	}
+	if (historyCount == historySize) {
+		historySize = max(16, historySize * 2);
+		history = (HistoryStep*)realloc(history, sizeof(HistoryStep) * historySize);
+	}
+	history[historyCount++] = step;
+	historyAt = historyCount;
+	historyBytes += step.bytes;
+	for (int s = 0; historyBytes > historyBudget && s < historyCount; s++) { dropDelta(history[s]); }
+}
+
+/**
+ * Drop Deltas function
+ * frees every step's delta once the worker moves to another level,
+ * where they no longer fit. The steps keep their chains and replay
+ * through those instead
+ */
+void dropDeltas() {
+	for (int s = 0; s < historyCount; s++) { dropDelta(history[s]); }
+}
+
+/**
+ * Filter Worker state
+ * menu() never filters on the GLUT thread. Keys queue up here and
+ * a worker thread takes everything queued at once as one pipeline,
+ * so a burst of keypresses becomes a single fused run, working on
+ * a copy while workBuffer stays on screen. The finished copy waits
+ * in backBuffer until the GLUT thread swaps it in from a timer, as
+ * GLUT must only be called from its own thread. When the view wants
+ * another preview level, the worker first reruns the chain there
+ */
+#define QUEUE_SIZE 256
+static pthread_mutex_t queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueWake = PTHREAD_COND_INITIALIZER;
+static char queued[QUEUE_SIZE + 1]; // keys waiting, in order
+static int queuedCount = 0;
+static bool workerBusy = false; // taken a batch and not yet swapped in
+static bool resultReady = false; // backBuffer holds a finished batch
+static bool discardRunning = false; // drop the batch now running
+static bool cancellable = false; // and stop it early, it's filters or a move through the history
+static Image backBuffer;
+static char *workChain = NULL; // what workBuffer holds, as filters since the last reset
+
+/**
+ * Fit Buffer function
+ * reallocates an image's pixels if it is not the size of another,
+ * for backBuffer after a level of another size was swapped in
+ */
+void fitBuffer(Image &img, const Image &like) {
+	if (img.width == like.width && img.height == like.height) { return; }
+	free(img.data);
+	img.width = like.width;
+	img.height = like.height;
+	img.data = (Pixel*)malloc(sizeof(Pixel) * img.width * img.height);
+	PROFILE_ALLOC(sizeof(Pixel) * img.width * img.height);
+}
+
+/**
+ * Switch Level function
+ * reruns the current chain on another preview level into
+ * backBuffer. Runs on the worker, through the result cache, so
+ * going back to a level seen before is mostly copying
+ *
+ * @param level - the level to move to
+ */
+void switchLevel(int level) {
+	PROFILE_SCOPE("switch level", 0, (size_t)previewLevels[level].width * previewLevels[level].height);
+	const Image &source = previewLevels[level];
+	fitBuffer(backBuffer, source);
+	memcpy(backBuffer.data, source.data, sizeof(Pixel) * source.width * source.height);
+	evaluateChain(backBuffer, previewHash[level], workChain, 0);
+	dropDeltas();
+}
+
+/**
+ * Save Full function
+ * what the s key writes: the chain so far run on the full image,
+ * or workBuffer itself when it is already full size
+ */
+void saveFull() {
+	if (workLevel == 0) {
+		saveImage("backup.tif", workBuffer);
+		return;
+	}
+	Image full = copyImage(saveBuffer);
+	evaluateChain(full, previewHash[0], workChain, 0);
+	saveImage("backup.tif", full);
+	free(full.data);
+}
+
+/**
+ * Filter Worker function
+ * takes queued keys a batch at a time: a run of filter keys, or a
+ * single undo (u), redo (y) or save (s). Filters are recorded in
+ * the history as they finish, a step per key, unless cancelled
+ * first. A change of preview level goes before anything queued
+ */
+void *filterWorker(void *unused) {
+	char spec[16 * QUEUE_SIZE];
+	unsigned seeds = (unsigned)time(NULL);
+	pthread_mutex_lock(&queueLock);
+	for (;;) {
+		while ((queuedCount == 0 && previewLevel == workLevel) || workerBusy) {
+			pthread_cond_wait(&queueWake, &queueLock);
+		}
+		if (previewLevel != workLevel) { // not cancellable, the view needs it
+			int level = previewLevel;
+			workerBusy = true;
+			cancellable = false;
+			pthread_mutex_unlock(&queueLock);
+			switchLevel(level);
+			pthread_mutex_lock(&queueLock);
+			workLevel = level;
+			resultReady = true;
+			continue;
+		}
+		char first = queued[0];
+		bool moving = (first == 'u' || first == 'y'); // through the history
+		int taken = 1;
+		while (!moving && first != 's' && taken < queuedCount && strchr("uys", queued[taken]) == NULL) { taken++; }
+		// a reset makes everything before it moot
+		const char *reset = moving ? NULL : (const char*)memrchr(queued, 'r', taken);
+		int n = 0;
+		if (reset != NULL) { n += sprintf(spec, "r,"); }
+		for (const char *k = (reset != NULL) ? reset + 1 : queued; k < queued + taken && !moving; k++) {
+			// a random quantize gets its seed now, so replaying its chain brings back the same palette
+			if (*k == 'i') { n += sprintf(spec + n, "i::%u,", rand_r(&seeds) | 1u); }
+			else {
+				spec[n++] = *k;
+				spec[n++] = ',';
+			}
+		}
+		spec[max(n - 1, 0)] = '\0';
+		memmove(queued, queued + taken, queuedCount - taken);
+		queuedCount -= taken;
+		// the source is read only on both threads until the swap
+		const Image &source = (reset != NULL) ? previewLevels[workLevel] : workBuffer;
+		workerBusy = true;
+		discardRunning = false;
+		cancellable = (first != 's'); // a save runs to the end or writes half an image
+		pthread_mutex_unlock(&queueLock);
+		// the history belongs to this thread alone
+		fitBuffer(backBuffer, source);
+		memcpy(backBuffer.data, source.data, sizeof(Pixel) * source.width * source.height);
+		bool changed = true;
+		HistoryStep steps[QUEUE_SIZE + 1];
+		int stepCount = 0;
+		if (first == 's') {
+			saveFull();
+			changed = false;
+		}
+		else if (first == 'u' && historyAt > 0) { replayStep(backBuffer, history[historyAt - 1], true); }
+		else if (first == 'y' && historyAt < historyCount) { replayStep(backBuffer, history[historyAt], false); }
+		else if (moving) { changed = false; } // nothing to undo or redo
+		else {
+			const char *filters = (reset != NULL) ? spec + 1 + (spec[1] == ',') : spec;
+			size_t done = (reset != NULL) ? 0 : strlen(workChain);
+			char *chain = (char*)malloc(done + strlen(filters) + 2);
+			sprintf(chain, (done > 0 && *filters != '\0') ? "%.*s,%s" : "%.*s%s", (int)done, workChain, filters);
+			if (*filters != '\0') { evaluateChain(backBuffer, previewHash[workLevel], chain, done); }
+			// a step per key, only the image before the first is known
+			const Image *before = &workBuffer;
+			if (reset != NULL) {
+				steps[stepCount] = makeStep("r", before, previewLevels[workLevel]);
+				steps[stepCount].before = strdup(workChain);
+				steps[stepCount++].after = strdup("");
+				before = &previewLevels[workLevel];
+			}
+			for (size_t at = done + (done > 0), length = strlen(chain); at < length;) {
+				size_t end = at;
+				while (chain[end] != '\0' && chain[end] != ',') { end++; }
+				char *key = strndup(chain + at, end - at);
+				HistoryStep &step = steps[stepCount++];
+				step = makeStep(key, (chain[end] == '\0') ? before : NULL, backBuffer);
+				step.before = strndup(chain, (at > 0) ? at - 1 : 0);
+				step.after = strndup(chain, end);
+				before = NULL;
+				free(key);
+				at = end + 1;
+			}
+			free(chain);
+		}
+		pthread_mutex_lock(&queueLock);
+		cancelRunning = false; // for whoever runs filters next
+		if (discardRunning || !changed) {
+			for (int s = 0; s < stepCount; s++) { freeStep(steps[s]); }
+			workerBusy = false;
+			continue;
+		}
+		free(workChain);
+		if (first == 'u') { workChain = strdup(history[--historyAt].before); }
+		else if (first == 'y') { workChain = strdup(history[historyAt++].after); }
+		else {
+			workChain = strdup(steps[stepCount - 1].after);
+			for (int s = 0; s < stepCount; s++) { pushStep(steps[s]); }
+		}
+		resultReady = true;
+	}
+	return NULL;
+}
+
+/**
+ * Queue Filter function
+ * hands a filter key, r to reset, u to undo or y to redo to the
+ * worker
+ */
+void queueFilter(char key) {
+	pthread_mutex_lock(&queueLock);
+	if (key == 'r') { // nothing before a reset matters
+		queuedCount = 0;
+		discardRunning = workerBusy && !resultReady;
+		cancelRunning = discardRunning && cancellable;
+	}
+	if (queuedCount < QUEUE_SIZE) { queued[queuedCount++] = key; }
+	pthread_cond_signal(&queueWake);
+	pthread_mutex_unlock(&queueLock);
+}
+
+/**
+ * Cancel Filters function
+ * drops every queued key and the result of the one running, which
+ * stops at its next stage. A save or a change of preview level
+ * still runs to the end
+ */
+void cancelFilters() {
+	pthread_mutex_lock(&queueLock);
+	queuedCount = 0;
+	discardRunning = workerBusy && !resultReady;
+	cancelRunning = discardRunning && cancellable;
+	pthread_mutex_unlock(&queueLock);
+}
+
+/**
+ * Poll Worker function
+ * GLUT timer that swaps a finished result in and shows whether
+ * the worker is busy in the title bar
+ */
+void pollWorker(int value) {
+	static bool wasBusy = false;
+	pthread_mutex_lock(&queueLock);
+	if (resultReady) { // swap the buffers, the old one is the next scratch
+		std::swap(workBuffer, backBuffer);
+		resultReady = false;
+		workerBusy = false;
+		if (displayTextured && (workBuffer.width != backBuffer.width || workBuffer.height != backBuffer.height)) {
+			makeDisplayTiles(); // another level
+		}
+		markDirty(0, workBuffer.height);
+		glutPostRedisplay();
+		pthread_cond_signal(&queueWake);
+	}
+	bool busy = workerBusy || queuedCount > 0;
+	pthread_mutex_unlock(&queueLock);
+	if (busy != wasBusy) {
+		glutSetWindowTitle(busy ? "3P98 Assignment 1 (filtering...)" : "3P98 Assignment 1");
+		wasBusy = busy;
+	}
+	glutTimerFunc(15, pollWorker, 0);
+}
+
+/**
+ * Choose Preview Level function
+ * picks the coarsest level whose pixels are no bigger than the
+ * screen's at the current zoom, and wakes the worker to move there
+ */
+void choosePreviewLevel() {
+	int level = 0;
+	while (previewMode && displayTextured && level + 1 < previewCount &&
+		viewZoom * saveBuffer.width / previewLevels[level + 1].width <= 1) {
+		level++;
+	}
+	pthread_mutex_lock(&queueLock);
+	if (level != previewLevel) {
+		previewLevel = level;
+		pthread_cond_signal(&queueWake);
+	}
+	pthread_mutex_unlock(&queueLock);
+}
+
+/**
+ * Start Worker function
+ * allocates backBuffer, builds the preview pyramid and starts the
+ * filter worker
+ */
+void startWorker() {
+	backBuffer = copyImage(workBuffer);
+	buildPreview();
+	workChain = strdup("");
+	pthread_t worker;
+	pthread_create(&worker, NULL, filterWorker, NULL);
+	pthread_detach(worker);
+	glutTimerFunc(15, pollWorker, 0);
+}
+
+/**
+ * Batch Output Name function
+ * decides where a processed input is written: the -o argument
+ * itself for a single input, or that directory plus the input's
+ * base name when many inputs are given
+ *
+ * @param out - the -o argument
+ * @param in - the input filename
+ * @param many - whether there is more than one input
+ * @param name - receives the output filename
+ * @param size - size of name
+ */
+void batchOutputName(const char *out, const char *in, bool many, char *name, size_t size) {
+	if (!many) {
+		snprintf(name, size, "%s", out);
+		return;
+	}
+	const char *base = strrchr(in, '/');
+	base = (base == NULL) ? in : base + 1;
+	snprintf(name, size, "%s/%s", out, base);
+}
+
+/**
+ * Stage Halo function
+ * how many rows above and below an output row a pipeline stage
+ * reads, so strips can be filtered on their own
+ *
+ * @param stage - the stage
+ * @return - the rows needed either side, -1 if the stage needs the
+ *  whole image at once (its palette depends on everything)
+ */
+int stageHalo(const Stage &stage) {
+	switch (stage.key) {
+	case 0: case 'h': { return 0; }
+	case '8': case '9': { return stage.arg ? max(0, atoi(stage.arg)) : max(0, morphRadius); }
+	case 'n': case 'o': { return stage.arg ? max(0, atoi(stage.arg)) : max(0, smoothRadius); }
+	case 'c': case 'd': case 'e': case 'f': case 'g': { return 1; }
+	case 'l': {
+		if (stage.arg == NULL) { return customKernel.taps ? customKernel.height / 2 : 0; }
+		Kernel k;
+		if (!loadKernel(stage.arg, k)) { return 0; } // fails when run
+		int halo = k.height / 2;
+		freeKernel(k);
+		return halo;
+	}
+	default: { return -1; }
+	}
+}
+
+// whether batch mode streams TIFFs strip by strip (--stream)
+bool streamMode = false;
+
+#ifdef WITH_LIBTIFF
+// output rows filtered per strip when streaming
+#define STREAM_ROWS 64
+
+/**
+ * Stream File function
+ * runs a pipeline over a TIFF a strip at a time. Each strip is
+ * read with enough rows either side to cover every stage's
+ * neighbourhood, run through the ordinary filters as a small image
+ * of its own, and only its middle rows written out, so results
+ * match filtering the whole image while memory stays a few strips
+ * of rows however tall the image is
+ *
+ * @param pipe - the compiled pipeline
+ * @param in - input TIFF
+ * @param out - output TIFF
+ * @param pixels - if given, receives the image's size in pixels
+ * @return - 0 done, 1 failed, -1 can't stream this, load it whole
+ */
+int streamFile(const Pipeline &pipe, const char *in, const char *out, long long *pixels = NULL) {
+	int halo = 0; // the whole pipeline's reach is the sum of its stages'
+	for (int s = 0; s < pipe.count; s++) {
+		int h = stageHalo(pipe.stages[s]);
+		if (h < 0) { return -1; }
+		halo += h;
+	}
+	TIFF *src = TIFFOpen(in, "r");
+	if (src == NULL) { return -1; }
+	uint32_t width = 0, height = 0;
+	uint16_t bits = 0, samples = 0, planar = 0, photometric = 0;
+	TIFFGetField(src, TIFFTAG_IMAGEWIDTH, &width);
+	TIFFGetField(src, TIFFTAG_IMAGELENGTH, &height);
+	TIFFGetFieldDefaulted(src, TIFFTAG_BITSPERSAMPLE, &bits);
+	TIFFGetFieldDefaulted(src, TIFFTAG_SAMPLESPERPIXEL, &samples);
+	TIFFGetFieldDefaulted(src, TIFFTAG_PLANARCONFIG, &planar);
+	TIFFGetField(src, TIFFTAG_PHOTOMETRIC, &photometric);
+	if (bits != 8 || (samples != 3 && samples != 4) || planar != PLANARCONFIG_CONTIG ||
+		photometric != PHOTOMETRIC_RGB || width == 0 || height == 0 || TIFFIsTiled(src)) {
+		TIFFClose(src); // anything else, tiled files too, goes through FreeImage's converters
+		return -1;
+	}
+	if (pixels != NULL) { *pixels = (long long)width * height; }
+	TIFF *dst = TIFFOpen(out, "w");
+	if (dst == NULL) {
+		TIFFClose(src);
+		return 1;
+	}
+	TIFFSetField(dst, TIFFTAG_IMAGEWIDTH, width);
+	TIFFSetField(dst, TIFFTAG_IMAGELENGTH, height);
+	TIFFSetField(dst, TIFFTAG_BITSPERSAMPLE, 8);
+	TIFFSetField(dst, TIFFTAG_SAMPLESPERPIXEL, 3);
+	TIFFSetField(dst, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(dst, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+	TIFFSetField(dst, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(dst, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(dst, 0));
+	/**
+	 * scanlines run top down but Images are stored bottom up, so
+	 * window holds scanlines [top, top+held) and each strip is
+	 * copied into work upside down before filtering
+	 */
+	int rows = max(STREAM_ROWS, 4 * halo), span = rows + 2 * halo;
+	Pixel *window = (Pixel*)malloc(sizeof(Pixel) * width * span);
+	GLubyte *line = (GLubyte*)malloc(TIFFScanlineSize(src));
+	Image work;
+	work.width = width;
+	work.bitmap = NULL;
+	work.mapping = NULL;
+	work.data = (Pixel*)malloc(sizeof(Pixel) * width * span);
+	int top = 0, held = 0, next = 0, failed = 0;
+	for (int first = 0; first < (int)height && !failed; first += rows) {
+		int last = min((int)height, first + rows);
+		int from = max(0, first - halo), to = min((int)height, last + halo);
+		int drop = from - top; // rows above this strip's reach
+		if (drop > 0) {
+			memmove(window, window + (size_t)drop * width, sizeof(Pixel) * width * (held - drop));
+			top = from;
+			held -= drop;
+		}
+		for (; next < to; next++, held++) {
+			if (TIFFReadScanline(src, line, next, 0) < 0) {
+				failed = 1;
+				break;
+			}
+			Pixel *p = window + (size_t)held * width;
+			for (uint32_t x = 0; x < width; x++) {
+				p[x].red = line[x * samples];
+				p[x].green = line[x * samples + 1];
+				p[x].blue = line[x * samples + 2];
+			}
+		}
+		if (failed) { break; }
+		work.height = to - from;
+		for (int y = from; y < to; y++) {
+			memcpy(work.data + (size_t)(to - 1 - y) * width, window + (size_t)(y - top) * width,
+				sizeof(Pixel) * width);
+		}
+		if (!runPipeline(work, pipe)) { failed = 1; }
+		for (int y = first; y < last && !failed; y++) {
+			if (TIFFWriteScanline(dst, work.data + (size_t)(to - 1 - y) * width, y, 0) < 0) { failed = 1; }
+		}
+	}
+	free(work.data);
+	free(line);
+	free(window);
+	TIFFClose(src);
+	TIFFClose(dst);
+	return failed;
+}
+#endif
+
+/**
+ * Batch Queue
+ * a bounded queue between two stages of the batch pipeline. Push
+ * waits while it is full, which is what bounds memory to the queue
+ * depth; pop waits while it is empty and fails once the stage
+ * before has closed it and it has drained
+ */
+typedef struct {
+	int input; // index into the inputs
+	int pipe; // pipeline the image went through, -1 for a decoded input
+	Image img;
+} BatchItem;
+typedef struct {
+	BatchItem *items;
+	int size, head, count;
+	int producers; // workers still pushing, closed at 0
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty, notFull;
+} BatchQueue;
+
+void batchQueueInit(BatchQueue &q, int depth, int producers) {
+	q.items = (BatchItem*)malloc(sizeof(BatchItem) * depth);
+	q.size = depth;
+	q.head = q.count = 0;
+	q.producers = producers;
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.notEmpty, NULL);
+	pthread_cond_init(&q.notFull, NULL);
+}
+
+void batchPush(BatchQueue &q, const BatchItem &item) {
+	pthread_mutex_lock(&q.lock);
+	while (q.count == q.size) { pthread_cond_wait(&q.notFull, &q.lock); }
+	q.items[(q.head + q.count++) % q.size] = item;
+	pthread_cond_signal(&q.notEmpty);
+	pthread_mutex_unlock(&q.lock);
+}
+
+bool batchPop(BatchQueue &q, BatchItem &item) {
+	pthread_mutex_lock(&q.lock);
+	while (q.count == 0 && q.producers > 0) { pthread_cond_wait(&q.notEmpty, &q.lock); }
+	bool got = q.count > 0;
+	if (got) {
+		item = q.items[q.head];
+		q.head = (q.head + 1) % q.size;
+		q.count--;
+		pthread_cond_signal(&q.notFull);
+	}
+	pthread_mutex_unlock(&q.lock);
+	return got;
+}
+
+/**
+ * Batch Done function
+ * a producer finished; the last one closes the queue
+ */
+void batchDone(BatchQueue &q) {
+	pthread_mutex_lock(&q.lock);
+	if (--q.producers == 0) { pthread_cond_broadcast(&q.notEmpty); }
+	pthread_mutex_unlock(&q.lock);
+}
+
+/**
+ * Batch state
+ * what every stage worker of one runBatch() shares
+ */
+typedef struct {
+	const char **specs, **outs;
+	int pipes;
+	char **inputs;
+	int count;
+	std::atomic<int> next; // next input to decode
+	std::atomic<int> failures;
+	std::atomic<int> images; // decoded or streamed
+	std::atomic<long long> pixels; // decoded, for the MP/s figure
+	BatchQueue decoded, filtered;
+} Batch;
+static pthread_mutex_t batchLog = PTHREAD_MUTEX_INITIALIZER;
+
+// worker threads per batch stage: decode, filter, encode (--batch-workers)
+int batchWorkers[3] = { 2, 1, 2 };
+int batchDepth = 4; // images each queue between stages holds (--batch-depth)
+
+/**
+ * Batch Fail function
+ * counts a failure and reports it on one line
+ */
+void batchFail(Batch &batch, const char *what, const char *name) {
+	batch.failures++;
+	pthread_mutex_lock(&batchLog);
+	cerr << what << " " << name << endl;
+	pthread_mutex_unlock(&batchLog);
+}
+
+/**
+ * Decode Worker function
+ * loads inputs until none are left. With --stream a TIFF going
+ * through a single pipeline is filtered a strip at a time right
+ * here and never enters the queues
+ */
+void *decodeWorker(void *arg) {
+	Batch &batch = *(Batch*)arg;
+	for (int f = batch.next++; f < batch.count; f = batch.next++) {
+#ifdef WITH_LIBTIFF
+		char name[4096];
+		batchOutputName(batch.outs[0], batch.inputs[f], batch.count > 1, name, sizeof(name));
+		const char *dot = strrchr(name, '.');
+		if (streamMode && batch.pipes == 1 && dot != NULL && (strcasecmp(dot, ".tif") == 0 || strcasecmp(dot, ".tiff") == 0)) {
+			Pipeline pipe;
+			compilePipeline(batch.specs[0], pipe);
+			long long pixels = 0;
+			int streamed = streamFile(pipe, batch.inputs[f], name, &pixels);
+			freePipeline(pipe);
+			if (streamed > 0) { batchFail(batch, "could not stream to", name); }
+			if (streamed == 0) {
+				batch.images++;
+				batch.pixels += pixels;
+			}
+			if (streamed >= 0) { continue; }
+		}
+#endif
+		BatchItem item;
+		item.input = f;
+		item.pipe = -1;
+		{
+			PROFILE_SCOPE("load", 0, 0);
+			item.img = imageLoader(batch.inputs[f]);
+		}
+		if (item.img.data == NULL) {
+			batchFail(batch, "could not load", batch.inputs[f]);
+			continue;
+		}
+		batch.images++;
+		batch.pixels += (long long)item.img.width * item.img.height;
+		batchPush(batch.decoded, item);
+	}
+	batchDone(batch.decoded);
+	return NULL;
+}
+
+/**
+ * Batch Filter Worker function
+ * runs every pipeline over each decoded image. A single pipeline
+ * filters in place; several each get a copy, their shared prefixes
+ * coming from the result cache
+ */
+void *batchFilterWorker(void *arg) {
+	Batch &batch = *(Batch*)arg;
+	BatchItem item;
+	while (batchPop(batch.decoded, item)) {
+		if (batch.pipes == 1) { // nothing to share
+			Pipeline pipe;
+			compilePipeline(batch.specs[0], pipe);
+			if (!runPipeline(item.img, pipe)) { batchFail(batch, "could not filter", batch.inputs[item.input]); }
+			freePipeline(pipe);
+			item.pipe = 0;
+			batchPush(batch.filtered, item);
+			continue;
+		}
+		uint64_t source = imageHash(item.img);
+		for (int p = 0; p < batch.pipes; p++) {
+			BatchItem result = { item.input, p, copyImage(item.img) };
+			char *chain = normalizeSpec(batch.specs[p]);
+			if (!evaluateChain(result.img, source, chain, 0)) { batchFail(batch, "could not filter", batch.inputs[item.input]); }
+			free(chain);
+			batchPush(batch.filtered, result);
+		}
+		dropResults(source);
+		releaseImage(item.img);
+	}
+	batchDone(batch.filtered);
+	return NULL;
+}
+
+/**
+ * Encode Worker function
+ * saves filtered images and frees them
+ */
+void *encodeWorker(void *arg) {
+	Batch &batch = *(Batch*)arg;
+	char name[4096];
+	BatchItem item;
+	while (batchPop(batch.filtered, item)) {
+		batchOutputName(batch.outs[item.pipe], batch.inputs[item.input], batch.count > 1, name, sizeof(name));
+		{
+			PROFILE_SCOPE("save", 0, (size_t)item.img.width * item.img.height);
+			if (!saveImage(name, item.img)) { batchFail(batch, "could not save", name); }
+		}
+		releaseImage(item.img);
+	}
+	return NULL;
+}
+
+/**
+ * Batch Mode function
+ * applies pipelines of menu keys to every input without ever
+ * creating a window, so it runs on machines with no display.
+ * Decoding, filtering and encoding each have their own workers
+ * (--batch-workers) joined by bounded queues (--batch-depth), so
+ * one file loads while another filters and a third saves, and at
+ * most a few images per queue are in memory at once. Each input is
+ * loaded once and each pipeline's result computed only to be saved;
+ * with several pipelines their shared prefixes come from the
+ * result cache rather than running again
+ *
+ * @param specs - the pipelines, already checked to compile
+ * @param outs - output file, or output directory for many inputs, per pipeline
+ * @param pipes - how many pipelines
+ * @param inputs - the input filenames
+ * @param count - the number of inputs
+ * @return - process exit status
+ */
+int runBatch(const char **specs, const char **outs, int pipes, char **inputs, int count) {
+	Batch batch;
+	batch.specs = specs;
+	batch.outs = outs;
+	batch.pipes = pipes;
+	batch.inputs = inputs;
+	batch.count = count;
+	batch.next = 0;
+	batch.failures = 0;
+	batch.images = 0;
+	batch.pixels = 0;
+	int workers[3];
+	for (int s = 0; s < 3; s++) { workers[s] = max(1, min(batchWorkers[s], count)); }
+	int depth = max(1, batchDepth);
+	batchQueueInit(batch.decoded, depth, workers[0]);
+	batchQueueInit(batch.filtered, depth, workers[1]);
+	void *(*stage[3])(void*) = { decodeWorker, batchFilterWorker, encodeWorker };
+	pthread_t *threads = (pthread_t*)malloc(sizeof(pthread_t) * (workers[0] + workers[1] + workers[2]));
+	int started = 0;
+	double start = seconds();
+	for (int s = 0; s < 3; s++) {
+		for (int w = 0; w < workers[s]; w++) { pthread_create(&threads[started++], NULL, stage[s], &batch); }
+	}
+	for (int t = 0; t < started; t++) { pthread_join(threads[t], NULL); }
+	double elapsed = max(seconds() - start, 1e-9);
+	cout << batch.images << " of " << count << " images in " << elapsed << " s, " << batch.images / elapsed
+		<< " images/s, " << batch.pixels / elapsed / 1e6 << " MP/s" << endl;
+	free(threads);
+	free(batch.decoded.items);
+	free(batch.filtered.items);
+	trimScratch();
+	return batch.failures == 0 ? 0 : 1;
+}
+
+/**
+ * Benchmark filters
+ * what --bench times, with the bytes each filter reads and writes
+ * per pixel on its way through memory: 6 for one in place pass,
+ * more where a scratch copy or an intermediate plane is involved
+ */
+static const struct {
+	char key;
+	const char *name;
+	int bytes;
+} benchFilters[] = {
+	{ '1', "greyscale", 6 }, { '2', "ntsc", 6 }, { '3', "monochrome", 6 }, { '4', "swap", 6 },
+	{ '5', "pure-r", 6 }, { '0', "intensity-r", 6 }, { '8', "max", 12 }, { '9', "min", 12 },
+	{ 'c', "edges-grey", 8 }, { 'd', "edges-color", 12 }, { 'e', "blur", 12 },
+	{ 'f', "gauss-blur", 12 }, { 'g', "sharpen", 12 }, { 'h', "quantize-fixed", 6 },
+	{ 'i', "quantize-random", 6 }, { 'm', "quantize-median-cut", 9 }, { 'j', "negative", 6 },
+	{ 'k', "sepia", 6 }, { 'n', "box-blur", 12 }, { 'o', "median", 12 }
+};
+
+/**
+ * Synthetic Image function
+ * fills an image with gradients plus noise, so edges, quantizers
+ * and max/min all have something realistic to chew on
+ */
+void syntheticImage(Image &img) {
+	parallelRows(img.height, img.width, [&](int begin, int end) {
+		unsigned state = 2463534242u ^ (unsigned)begin;
+		for (int i = begin; i < end; i++) {
+			Pixel *row = img.data + (size_t)i*img.width;
+			for (int j = 0; j < img.width; j++) {
+				state ^= state << 13; // xorshift
+				state ^= state >> 17;
+				state ^= state << 5;
+				row[j].red = (GLubyte)(j * 255 / img.width + (state & 31));
+				row[j].green = (GLubyte)(i * 255 / img.height + ((state >> 8) & 31));
+				row[j].blue = (GLubyte)(((i + j) & 255) ^ ((state >> 16) & 15));
+			}
+		}
+	});
+}
+
+/**
+ * Parse List function
+ * reads a comma separated list of positive numbers
+ *
+ * @param text - eg. "1,4,16"
+ * @param values - receives up to size numbers
+ * @param size - capacity of values
+ * @return - how many were read
+ */
+int parseList(const char *text, int *values, int size) {
+	int count = 0;
+	for (const char *p = text; *p != '\0' && count < size;) {
+		char *next;
+		long v = strtol(p, &next, 10);
+		if (next == p) { break; }
+		if (v > 0) { values[count++] = (int)v; }
+		p = (*next == ',') ? next + 1 : next;
+	}
+	return count;
+}
+
+// what --bench covers, see parseList() for the list format
+const char *benchSizes = "1,4,16", *benchThreads = NULL;
+int benchRuns = 5;
+bool benchJson = false;
+
+/**
+ * Benchmark function
+ * times every filter on synthetic images of each size (in
+ * megapixels) at each thread count. Each run gets a fresh copy of
+ * the source, which isn't timed. Reports the mean, the standard
+ * deviation over the runs, megapixels per second and the memory
+ * traffic that implies, as a table or as JSON (--bench --json)
+ *
+ * @return - process exit status
+ */
+int runBenchmark() {
+	int sizes[16], threads[16], sizeCount = parseList(benchSizes, sizes, 16), threadCounts;
+	if (benchThreads != NULL) {
+		threadCounts = parseList(benchThreads, threads, 16);
+	}
+	else { // one thread and all of them
+		threads[0] = 1;
+		threads[1] = threadTotal();
+		threadCounts = (threads[1] > 1) ? 2 : 1;
+	}
+	int runs = max(1, benchRuns);
+	double *ms = (double*)malloc(sizeof(double) * runs);
+	if (benchJson) { cout << "{\"runs\": " << runs << ", \"results\": ["; }
+	else { cout << "filter\t\t\tMP\tthreads\tms\t+/-ms\tMP/s\tB/px\tGB/s" << endl; }
+	bool first = true;
+	for (int s = 0; s < sizeCount; s++) {
+		Image source, work;
+		source.width = work.width = (int)sqrt(sizes[s] * 1e6 * 4 / 3); // 4:3
+		source.height = work.height = (int)(sizes[s] * 1e6 / source.width);
+		source.bitmap = work.bitmap = NULL;
+		source.mapping = work.mapping = NULL;
+		size_t pixels = (size_t)source.width * source.height;
+		source.data = (Pixel*)malloc(sizeof(Pixel) * pixels);
+		work.data = (Pixel*)malloc(sizeof(Pixel) * pixels);
+		if (source.data == NULL || work.data == NULL) {
+			cerr << "not enough memory for " << sizes[s] << " MP" << endl;
+			free(source.data);
+			free(work.data);
+			continue;
+		}
+		syntheticImage(source);
+		for (int t = 0; t < threadCounts; t++) {
+			threadCount = threads[t];
+			for (size_t f = 0; f < sizeof(benchFilters) / sizeof(benchFilters[0]); f++) {
+				double mean = 0, spread = 0;
+				for (int r = 0; r < runs; r++) {
+					parallelRows(work.height, work.width, [&](int begin, int end) {
+						memcpy(work.data + (size_t)begin*work.width, source.data + (size_t)begin*work.width,
+							sizeof(Pixel)*work.width*(end - begin));
+					});
+					double start = seconds();
+					applyFilter(work, benchFilters[f].key);
+					ms[r] = (seconds() - start) * 1000;
+					mean += ms[r] / runs;
+				}
+				for (int r = 0; r < runs; r++) { spread += (ms[r] - mean) * (ms[r] - mean) / runs; }
+				spread = sqrt(spread);
+				double mps = pixels / 1e3 / mean, gbs = mps * benchFilters[f].bytes / 1e3;
+				if (benchJson) {
+					cout << (first ? "" : ",") << "\n  {\"filter\": \"" << benchFilters[f].name << "\", \"key\": \""
+						<< benchFilters[f].key << "\", \"width\": " << work.width << ", \"height\": " << work.height
+						<< ", \"threads\": " << threads[t] << ", \"mean_ms\": " << mean << ", \"stddev_ms\": "
+						<< spread << ", \"mpix_per_s\": " << mps << ", \"bytes_per_pixel\": "
+						<< benchFilters[f].bytes << ", \"gb_per_s\": " << gbs << "}";
+				}
+				else {
+					printf("%-20s\t%d\t%d\t%.2f\t%.2f\t%.1f\t%d\t%.2f\n", benchFilters[f].name, sizes[s], threads[t],
+						mean, spread, mps, benchFilters[f].bytes, gbs);
+				}
+				first = false;
+			}
+		}
+		free(source.data);
+		free(work.data);
+		trimScratch();
+	}
+	if (benchJson) { cout << "\n]}" << endl; }
+	free(ms);
+	return 0;
+}
+
+/**
+ * Reference Median Cut function
+ * the median cut palette worked out the long way for --verify: the
+ * image's colours binned 8 values wide per channel, boxes of bins
+ * split at the median of the widest, then k-means rounds with every
+ * bin measured against every colour
+ *
+ * @param src - the image
+ * @param colors - how many colours
+ * @param pal - receives the palette
+ */
+void referenceMedianCut(const Image &src, int colors, Palette &pal) {
+	const int bins = 32 * 32 * 32;
+	long long (*bin)[4] = (long long(*)[4])calloc(bins, sizeof(long long) * 4); // count, red, green, blue
+	for (int k = 0; k < src.width * src.height; k++) {
+		const GLubyte *p = (const GLubyte*)(src.data + k);
+		long long *b = bin[(p[0] / 8) * 1024 + (p[1] / 8) * 32 + p[2] / 8];
+		b[0]++;
+		for (int c = 0; c < 3; c++) { b[c + 1] += p[c]; }
+	}
+	int n = 0, *id = (int*)malloc(sizeof(int) * bins), *box = (int*)malloc(sizeof(int) * bins);
+	int (*mid)[3] = (int(*)[3])malloc(sizeof(int) * 3 * bins);
+	for (int b = 0; b < bins; b++) {
+		if (bin[b][0] == 0) { continue; }
+		id[n] = b;
+		box[n] = 0;
+		for (int c = 0; c < 3; c++) { mid[n][c] = (int)(bin[b][c + 1] / bin[b][0]); }
+		n++;
+	}
+	int boxes = 1;
+	while (boxes < colors) {
+		int widest = -1, axis = 0, range = 0;
+		for (int b = 0; b < boxes; b++) {
+			int members = 0;
+			for (int e = 0; e < n; e++) { members += (box[e] == b); }
+			if (members < 2) { continue; }
+			for (int c = 0; c < 3; c++) {
+				int lo = 255, hi = 0;
+				for (int e = 0; e < n; e++) {
+					if (box[e] != b) { continue; }
+					lo = min(lo, mid[e][c]);
+					hi = max(hi, mid[e][c]);
+				}
+				if (hi - lo > range) {
+					range = hi - lo;
+					widest = b;
+					axis = c;
+				}
+			}
+		}
+		if (widest < 0) { break; }
+		// the widest box's bins in order along the axis, bin number breaking ties
+		int members = 0, *order = (int*)malloc(sizeof(int) * n);
+		for (int e = 0; e < n; e++) {
+			if (box[e] == widest) { order[members++] = e; }
+		}
+		std::stable_sort(order, order + members, [&](int a, int b) { return mid[a][axis] < mid[b][axis]; });
+		long long total = 0, below = 0;
+		for (int m = 0; m < members; m++) { total += bin[id[order[m]]][0]; }
+		int lower = 0; // the last bin of the lower half
+		while (lower < members - 2 && (below + bin[id[order[lower]]][0]) * 2 < total) { below += bin[id[order[lower++]]][0]; }
+		for (int m = lower + 1; m < members; m++) { box[order[m]] = boxes; }
+		free(order);
+		boxes++;
+	}
+	pal.count = boxes;
+	for (int round = 0; ; round++) {
+		for (int b = 0; b < boxes; b++) {
+			long long total[4] = { 0, 0, 0, 0 };
+			for (int e = 0; e < n; e++) {
+				if (box[e] != b) { continue; }
+				for (int c = 0; c < 4; c++) { total[c] += bin[id[e]][c]; }
+			}
+			if (total[0] == 0) { continue; } // empty, its colour stays as it was
+			for (int c = 0; c < 3; c++) { pal.color[b][c] = (int)((total[c + 1] + total[0] / 2) / total[0]); }
+		}
+		if (round == KMEANS_ROUNDS) { break; }
+		for (int e = 0; e < n; e++) { // nearest colour, the first of equals
+			int best = 1 << 30;
+			for (int b = 0; b < boxes; b++) {
+				int dist = 0;
+				for (int c = 0; c < 3; c++) { dist += (mid[e][c] - pal.color[b][c]) * (mid[e][c] - pal.color[b][c]); }
+				if (dist < best) {
+					best = dist;
+					box[e] = b;
+				}
+			}
+		}
+	}
+	free(mid);
+	free(box);
+	free(id);
+	free(bin);
+}
+
+/**
+ * Reference Filter function
+ * the plainest way to compute a filter, one pixel at a time on one
+ * thread with no tricks, for --verify to hold the real filters to.
+ * Every formula is written out here rather than borrowed from the
+ * filters, so a mistake in one shows up as a difference
+ *
+ * @param img - the image to work with
+ * @param key - the menu key of the filter
+ * @param arg - the key's argument, NULL for defaults
+ */
+void referenceFilter(Image &img, char key, const char *arg) {
+	static const int matrices[3][9] = {
+		{ 1, 1, 1, 1, 1, 1, 1, 1, 1 }, // Blur
+		{ 1, 2, 1, 2, 4, 2, 1, 2, 1 }, // Gauss. Blur
+		{ 0, -1, 0, -1, 5, -1, 0, -1, 0 } // Sharpen
+	};
+	int w = img.width, h = img.height;
+	Image src = copyImage(img);
+	if (key != 0 && strchr("12345670abjk", key) != NULL) { // in doubles, as the filters first were
+		for (int k = 0; k < w * h; k++) {
+			const GLubyte *s = (const GLubyte*)(src.data + k);
+			GLubyte *p = (GLubyte*)(img.data + k);
+			switch (key) {
+			case '1': case '3': { // each term truncated on its own
+				int lum = (int)(s[0] * 0.33) + (int)(s[1] * 0.33) + (int)(s[2] * 0.33);
+				p[0] = p[1] = p[2] = (key == '1') ? lum : (lum > 128) ? 255 : 0;
+				break;
+			}
+			case '2': { p[0] = p[1] = p[2] = (int)(s[0] * 0.30) + (int)(s[1] * 0.59) + (int)(s[2] * 0.11); break; }
+			case '4': {
+				p[0] = s[1];
+				p[1] = s[2];
+				p[2] = s[0];
+				break;
+			}
+			case '5': case '6': case '7': {
+				for (int c = 0; c < 3; c++) { p[c] = (c == key - '5') ? s[c] : 0; }
+				break;
+			}
+			case '0': case 'a': case 'b': {
+				int c = (key == '0') ? 0 : key - 'a' + 1;
+				p[c] = (GLubyte)min(255.0, s[c] * 1.15);
+				break;
+			}
+			case 'j': {
+				for (int c = 0; c < 3; c++) { p[c] = 255 - s[c]; }
+				break;
+			}
+			case 'k': {
+				p[0] = (GLubyte)min(255.0, s[0] * 0.393 + s[1] * 0.769 + s[2] * 0.189);
+				p[1] = (GLubyte)min(255.0, s[0] * 0.349 + s[1] * 0.686 + s[2] * 0.168);
+				p[2] = (GLubyte)min(255.0, s[0] * 0.272 + s[1] * 0.534 + s[2] * 0.131);
+				break;
+			}
+			}
+		}
+	}
+	else if (key == 'e' || key == 'f' || key == 'g') { // taps off the image left out of sum and divisor
+		const int *m = matrices[key - 'e'];
+		for (int i = 0; i < h; i++) {
+			for (int j = 0; j < w; j++) {
+				for (int c = 0; c < 3; c++) {
+					int sum = 0, weight = 0;
+					for (int y = max(0, i - 1); y <= min(h - 1, i + 1); y++) {
+						for (int x = max(0, j - 1); x <= min(w - 1, j + 1); x++) {
+							int tap = m[(y - i + 1) * 3 + x - j + 1];
+							sum += tap * ((const GLubyte*)(src.data + y * w + x))[c];
+							weight += tap;
+						}
+					}
+					int v = sum / max(weight, 1);
+					((GLubyte*)(img.data + i * w + j))[c] = (v < 0) ? 0 : (v > 255) ? 255 : v;
+				}
+			}
+		}
+	}
+	else if (key == '8' || key == '9') { // every pixel of the clipped window
+		int r = arg ? atoi(arg) : morphRadius;
+		for (int i = 0; i < h; i++) {
+			for (int j = 0; j < w; j++) {
+				GLubyte *out = (GLubyte*)(img.data + i * w + j);
+				for (int c = 0; c < 3; c++) {
+					int best = (key == '8') ? 0 : 255;
+					for (int y = max(0, i - r); y <= min(h - 1, i + r); y++) {
+						for (int x = max(0, j - r); x <= min(w - 1, j + r); x++) {
+							int v = ((GLubyte*)(src.data + y * w + x))[c];
+							best = (key == '8') ? max(best, v) : min(best, v);
+						}
+					}
+					out[c] = best;
+				}
+			}
+		}
+	}
+	else if (key == 'n' || key == 'o') { // every pixel of the clipped window, sorted for the median
+		int r = arg ? atoi(arg) : smoothRadius;
+		GLubyte *window = (GLubyte*)malloc((size_t)(2 * r + 1) * (2 * r + 1));
+		for (int i = 0; i < h; i++) {
+			for (int j = 0; j < w; j++) {
+				for (int c = 0; c < 3; c++) {
+					int n = 0, sum = 0;
+					for (int y = max(0, i - r); y <= min(h - 1, i + r); y++) {
+						for (int x = max(0, j - r); x <= min(w - 1, j + r); x++) {
+							window[n] = ((GLubyte*)(src.data + y * w + x))[c];
+							sum += window[n++];
+						}
+					}
+					if (key == 'o') { std::nth_element(window, window + (n - 1) / 2, window + n); }
+					((GLubyte*)(img.data + i * w + j))[c] = (key == 'n') ? sum / n : window[(n - 1) / 2];
+				}
+			}
+		}
+		free(window);
+	}
+	else if (key == 'c' || key == 'd') {
+		for (int i = 0; i < h; i++) {
+			for (int j = 0; j < w; j++) {
+				for (int c = 0; c < 3; c++) {
+					int v[3][3]; // the neighbourhood, edges repeated
+					for (int y = 0; y < 3; y++) {
+						for (int x = 0; x < 3; x++) {
+							const Pixel &p = src.data[max(0, min(h - 1, i + y - 1)) * w + max(0, min(w - 1, j + x - 1))];
+							v[y][x] = (key == 'c') ? (int)(p.red * 0.33) + (int)(p.green * 0.33) + (int)(p.blue * 0.33)
+								: ((const GLubyte*)&p)[c];
+						}
+					}
+					int gx = v[0][2] + 2 * v[1][2] + v[2][2] - v[0][0] - 2 * v[1][0] - v[2][0];
+					int gy = v[2][0] + 2 * v[2][1] + v[2][2] - v[0][0] - 2 * v[0][1] - v[0][2];
+					int mag = (edgeNorm == '1') ? abs(gx) + abs(gy) : (int)(sqrtf((float)(gx*gx + gy*gy)) + 0.5f);
+					((GLubyte*)(img.data + i * w + j))[c] = min(255, mag);
+				}
+			}
+		}
+	}
+	else if (key == 'h' || key == 'm') { // nearest colour by searching them all
+		Palette pal;
+		int fixed[9][3] = {
+			{ 255, 0, 0 },{ 0, 255, 0 },{ 0, 0, 255 },{ 255, 255, 255 },{ 0, 0, 0 },
+			{ 128, 128, 128 },{ 128, 128, 0 },{ 0, 128, 128 },{ 128, 0, 128 }
+		};
+		if (key == 'm') { referenceMedianCut(src, max(1, min(256, arg ? atoi(arg) : paletteColors)), pal); }
+		else {
+			pal.count = 9;
+			memcpy(pal.color, fixed, sizeof(fixed));
+		}
+		for (int k = 0; k < w * h; k++) {
+			GLubyte *p = (GLubyte*)(img.data + k);
+			int best = 0, bestDist = 1 << 30;
+			for (int i = 0; i < pal.count; i++) {
+				int dist = 0;
+				for (int c = 0; c < 3; c++) { dist += (p[c] - pal.color[i][c]) * (p[c] - pal.color[i][c]); }
+				if (dist < bestDist) {
+					bestDist = dist;
+					best = i;
+				}
+			}
+			for (int c = 0; c < 3; c++) { p[c] = pal.color[best][c]; }
+		}
+	}
+	else if (key == 'l') { // customKernel, straight from its definition
+		const Kernel &k = customKernel;
+		for (int i = 0; i < h; i++) {
+			for (int j = 0; j < w; j++) {
+				for (int c = 0; c < 3; c++) {
+					float sum = 0;
+					for (int y = 0; y < k.height; y++) {
+						for (int x = 0; x < k.width; x++) {
+							const Pixel &p = src.data[max(0, min(h - 1, i + y - k.height / 2)) * w +
+								max(0, min(w - 1, j + x - k.width / 2))];
+							sum += k.taps[y * k.width + x] * ((const GLubyte*)&p)[c];
+						}
+					}
+					float v = sum / k.divisor + 0.5f;
+					((GLubyte*)(img.data + i * w + j))[c] = (v <= 0) ? 0 : (v >= 255) ? 255 : (GLubyte)v;
+				}
+			}
+		}
+	}
+	free(src.data);
+}
+
+/**
+ * Verify Check type
+ * a pipeline to hold to the reference filters, how far its output
+ * may stray from theirs, and which variants to run it as: S scalar,
+ * V SIMD, T threaded, D/P/F for the direct, separable and FFT
+ * kernel methods, or L threaded on planes (--planar). P checks get
+ * a separable kernel, D and F one that isn't
+ */
+static const struct {
+	const char *spec;
+	int tolerance;
+	const char *variants;
+} verifyChecks[] = {
+	{ "1", 0, "SVT" }, { "2", 0, "SVT" }, { "3", 0, "SVT" }, { "4", 0, "SVT" }, { "6", 0, "SVT" },
+	{ "a", 0, "SVT" }, { "j", 0, "SVT" }, { "k", 1, "SVT" }, // sepia's fixed point is within 1
+	{ "4,5,0,j", 0, "SVT" }, { "1,k,j,3", 0, "SVT" }, { "2,e,k,j", 1, "SVT" }, // fused
+	{ "e", 0, "SVT" }, { "f", 0, "SVT" }, { "g", 0, "SVT" }, { "c", 0, "SVT" }, { "d", 0, "SVT" },
+	{ "8:1", 0, "SVT" }, { "9:1", 0, "SVT" }, { "8:4", 0, "SVT" }, { "9:7", 0, "SVT" },
+	{ "h", 0, "SVT" }, { "m:16", 0, "SVT" },
+	{ "n:1", 0, "SVT" }, { "n:6", 0, "SVT" }, { "o:1", 0, "SVT" }, { "o:4", 0, "SVT" }, { "1,o:5,n:9", 0, "SVT" },
+	{ "l", 0, "D" }, { "l", 0, "P" }, { "l", 1, "F" }, // FFT rounding may land a tie either way
+	{ "e", 0, "L" }, { "f", 0, "L" }, { "g", 0, "L" }, { "8:1", 0, "L" }, { "9:7", 0, "L" },
+	{ "4,6,f,a,9:2,j,0", 0, "L" }, { "5,e,b", 0, "L" } // planes, with maps mixed in
+};
+
+/**
+ * Verify function
+ * runs every check on generated images of awkward shapes plus any
+ * given images, comparing each variant with the reference filters
+ * channel by channel. Prints the largest and mean difference per
+ * channel for every run (--verify)
+ *
+ * @param inputs - extra images to check
+ * @param count - number of extra images
+ * @return - 0 if nothing strayed past its tolerance, 1 otherwise
+ */
+int runVerify(char **inputs, int count) {
+	static const int shapes[][2] = { { 1, 1 }, { 1, 37 }, { 37, 1 }, { 2, 3 }, { 17, 5 }, { 63, 64 },
+		{ 257, 131 }, { 640, 480 } };
+	int generated = sizeof(shapes) / sizeof(shapes[0]), failures = 0, runs = 0;
+	int savedThreads = threadCount, savedSimd = simdCap;
+	long long savedSerial = serialPixels;
+	serialPixels = 0; // small images too, or T would only thread the larger shapes
+	char savedMethod = kernelMethod;
+	bool savedPlanar = planarMode;
+	Kernel savedKernel = customKernel;
+	float taps[35], column[5] = { 1, 3, -2, 4, 1 }, row[7] = { 2, 0, 1, 5, 1, -1, 1 };
+	for (int t = 0; t < 35; t++) { taps[t] = (float)((t * 7) % 11) - 3; }
+	Kernel lopsided = makeKernel(7, 5, taps, 0); // the anchor matters
+	for (int t = 0; t < 35; t++) { taps[t] = column[t / 7] * row[t % 7]; }
+	Kernel separable = makeKernel(7, 5, taps, 0);
+	for (int n = 0; n < generated + count; n++) {
+		Image img;
+		char label[64];
+		if (n < generated) {
+			img.width = shapes[n][0];
+			img.height = shapes[n][1];
+			img.bitmap = NULL;
+			img.mapping = NULL;
+			img.data = (Pixel*)malloc(sizeof(Pixel) * img.width * img.height);
+			syntheticImage(img);
+			snprintf(label, sizeof(label), "%dx%d", img.width, img.height);
+		}
+		else {
+			img = imageLoader(inputs[n - generated]);
+			if (img.data == NULL) {
+				cerr << "could not load " << inputs[n - generated] << endl;
+				failures++;
+				continue;
+			}
+			snprintf(label, sizeof(label), "%.63s", inputs[n - generated]);
+		}
+		size_t pixels = (size_t)img.width * img.height;
+		for (size_t c = 0; c < sizeof(verifyChecks) / sizeof(verifyChecks[0]); c++) {
+			customKernel = (verifyChecks[c].variants[0] == 'P') ? separable : lopsided;
+			Image expect = copyImage(img);
+			char *spec = strdup(verifyChecks[c].spec), *save = NULL;
+			for (char *tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+				referenceFilter(expect, tok[0], tok[1] == ':' ? tok + 2 : NULL);
+			}
+			free(spec);
+			for (const char *v = verifyChecks[c].variants; *v != '\0'; v++) {
+				threadCount = (*v == 'S' || *v == 'V') ? 1 : max(4, threadTotal());
+				simdCap = (*v == 'S') ? 0 : 2;
+				kernelMethod = (*v == 'P') ? 'S' : (*v == 'D') ? 'D' : 'F';
+				planarMode = (*v == 'L');
+				Image got = copyImage(img);
+				Pipeline pipe;
+				compilePipeline(verifyChecks[c].spec, pipe);
+				runPipeline(got, pipe);
+				freePipeline(pipe);
+				int worst[3] = { 0, 0, 0 };
+				double mean[3] = { 0, 0, 0 };
+				for (size_t k = 0; k < pixels * 3; k++) {
+					int d = abs(((GLubyte*)got.data)[k] - ((GLubyte*)expect.data)[k]);
+					worst[k % 3] = max(worst[k % 3], d);
+					mean[k % 3] += (double)d / pixels;
+				}
+				bool failed = max(worst[0], max(worst[1], worst[2])) > verifyChecks[c].tolerance;
+				printf("%-8s %c %-16s max %3d %3d %3d  mean %.4f %.4f %.4f  %s\n", verifyChecks[c].spec, *v, label,
+					worst[0], worst[1], worst[2], mean[0], mean[1], mean[2], failed ? "FAIL" : "ok");
+				failures += failed;
+				runs++;
+				free(got.data);
+			}
+			free(expect.data);
+		}
+		releaseImage(img);
+	}
+	freeKernel(lopsided);
+	freeKernel(separable);
+	customKernel = savedKernel;
+	threadCount = savedThreads;
+	simdCap = savedSimd;
+	serialPixels = savedSerial;
+	kernelMethod = savedMethod;
+	planarMode = savedPlanar;
+	cout << runs - failures << "/" << runs << " runs matched the reference" << endl;
+	return failures == 0 ? 0 : 1;
+}
+
+/**
+ * Usage function
+ * prints the command line forms of the program
+ *
+ * @param prog - the program name
+ */
+void printUsage(const char *prog) {
+	cout << "usage: " << prog << " <image.tif>" << endl;
+	cout << "       " << prog << " --pipeline \"2,f,g,k\" -o <out.tif|outdir> <in.tif>..." << endl;
+	cout << "pipeline entries are the menu keys below, applied left to right" << endl;
+	cout << "with several inputs, -o names a directory to write them into" << endl;
+	cout << "repeat --pipeline ... -o ... to write several results per input, shared prefixes run once" << endl;
+	cout << "inputs may be quoted globs, eg. \"scans/*.tif\"; --batch-workers 2,1,2 sets the decode, filter" << endl;
+	cout << "        and encode threads, --batch-depth 4 the images queued between them" << endl;
+	cout << "--result-cache-mb N caps the memory cached filter results may use, default 256" << endl;
+	cout << "--threads N caps filters at N threads, the default is one per core" << endl;
+	cout << "--radius N sets the max/min window to (2N+1)x(2N+1), pipelines take 8:N, 9:N" << endl;
+	cout << "--smooth-radius N sets the box blur and median window to (2N+1)x(2N+1), default 3," << endl;
+	cout << "        pipelines take n:N, o:N" << endl;
+	cout << "--edge-norm 1|2 picks the L1 or L2 (default) edge magnitude" << endl;
+	cout << "--simd N caps vector code at 0 plain C, 1 SSE4.1, 2 AVX2 (default)" << endl;
+	cout << "--colors N sets the median cut palette size, pipelines take m:N, i:N" << endl;
+	cout << "--planar runs blur, sharpen, max/min and per channel filters on separate channel planes" << endl;
+	cout << "--stream filters TIFFs a strip at a time, for images larger than memory" << endl;
+	cout << "--cache keeps a raw copy of each input as name.ifc and maps it on later runs" << endl;
+	cout << "--bench [--json] times every filter, --bench-sizes 1,4,16 (MP), --bench-threads 1,8," << endl;
+	cout << "        --bench-runs 5 choose what it covers" << endl;
+	cout << "--verify [in.tif...] checks every filter variant against reference filters" << endl;
+	cout << "--profile prints time spent per action at exit (key p prints it so far), --trace FILE" << endl;
+	cout << "        writes a Chrome trace, both need a -DPROFILE build" << endl;
+	cout << "--history-mb N caps the memory undo history may use, default 256" << endl;
+	cout << "--no-preview filters the full image interactively instead of a level sized to the window" << endl;
+	cout << "--kernel FILE loads the kernel for key l, pipelines take l:FILE" << endl;
+	cout << "--kernel-method auto|direct|separable|fft forces a convolution method" << endl;
+	cout << "--bench-kernels times each method over kernel sizes and exits" << endl;
+	cout << "--bench-specialized times generic against compile time specialized filter loops and exits" << endl;
+}
+
+int main(int argc, char** argv) {
+	const char **pipelines = (const char**)malloc(sizeof(char*)*argc), **outs = (const char**)malloc(sizeof(char*)*argc);
+	char **inputs = (char**)malloc(sizeof(char*)*argc);
+	int count = 0, pipes = 0, outCount = 0, inputSize = argc;
+	bool bench = false, verify = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+			pipelines[pipes++] = argv[++i];
+		}
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			outs[outCount++] = argv[++i];
+		}
+		else if (strcmp(argv[i], "--radius") == 0 && i + 1 < argc) {
+			morphRadius = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--smooth-radius") == 0 && i + 1 < argc) {
+			smoothRadius = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--edge-norm") == 0 && i + 1 < argc) {
+			edgeNorm = (argv[++i][0] == '1') ? '1' : '2';
+		}
+		else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+			simdCap = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			threadCount = atoi(argv[++i]);
+			threadCount = max(0, threadCount);
+		}
+		else if (strcmp(argv[i], "--no-preview") == 0) {
+			previewMode = false;
+		}
+		else if (strcmp(argv[i], "--planar") == 0) {
+			planarMode = true;
+		}
+		else if (strcmp(argv[i], "--stream") == 0) {
+#ifndef WITH_LIBTIFF
+			cerr << "--stream needs a build with -DWITH_LIBTIFF -ltiff, loading images whole" << endl;
+#endif
+			streamMode = true;
+		}
+		else if (strcmp(argv[i], "--bench") == 0) {
+			bench = true;
+		}
+		else if (strcmp(argv[i], "--verify") == 0) {
+			verify = true;
+		}
+		else if (strcmp(argv[i], "--json") == 0) {
+			benchJson = true;
+		}
+		else if (strcmp(argv[i], "--bench-sizes") == 0 && i + 1 < argc) {
+			benchSizes = argv[++i];
+		}
+		else if (strcmp(argv[i], "--bench-threads") == 0 && i + 1 < argc) {
+			benchThreads = argv[++i];
+		}
+		else if (strcmp(argv[i], "--bench-runs") == 0 && i + 1 < argc) {
+			benchRuns = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--profile") == 0 || (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)) {
+#ifdef PROFILE
+			if (argv[i][2] == 't') { profileTraceName = argv[++i]; }
+			else { profileWanted = true; }
+#else
+			i += (argv[i][2] == 't');
+			cerr << "profiling needs a build with -DPROFILE" << endl;
+#endif
+		}
+		else if (strcmp(argv[i], "--history-mb") == 0 && i + 1 < argc) {
+			int mb = atoi(argv[++i]);
+			historyBudget = (size_t)max(0, mb) << 20;
+		}
+		else if (strcmp(argv[i], "--result-cache-mb") == 0 && i + 1 < argc) {
+			int mb = atoi(argv[++i]);
+			resultBudget = (size_t)max(0, mb) << 20;
+		}
+		else if (strcmp(argv[i], "--cache") == 0) {
+			cacheMode = true;
+		}
+		else if (strcmp(argv[i], "--colors") == 0 && i + 1 < argc) {
+			paletteColors = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+			if (!loadKernel(argv[++i], customKernel)) {
+				cerr << "could not read a kernel from " << argv[i] << endl;
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "--kernel-method") == 0 && i + 1 < argc) {
+			const char *method = argv[++i];
+			if (strcasecmp(method, "auto") == 0) { kernelMethod = 'A'; }
+			else if (strcasecmp(method, "direct") == 0) { kernelMethod = 'D'; }
+			else if (strcasecmp(method, "separable") == 0) { kernelMethod = 'S'; }
+			else if (strcasecmp(method, "fft") == 0) { kernelMethod = 'F'; }
+			else {
+				cerr << "unknown kernel method " << method << ", use auto, direct, separable or fft" << endl;
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "--bench-kernels") == 0) {
+			benchKernels(1920, 1080);
+			return 0;
+		}
+		else if (strcmp(argv[i], "--bench-specialized") == 0) {
+			benchSpecialized(1920, 1080);
+			return 0;
+		}
+		else if (strcmp(argv[i], "--batch-workers") == 0 && i + 1 < argc) {
+			sscanf(argv[++i], "%d,%d,%d", &batchWorkers[0], &batchWorkers[1], &batchWorkers[2]);
+		}
+		else if (strcmp(argv[i], "--batch-depth") == 0 && i + 1 < argc) {
+			batchDepth = atoi(argv[++i]);
+		}
+		else if (strpbrk(argv[i], "*?[") != NULL && access(argv[i], F_OK) != 0) { // a glob the shell left alone
+			glob_t found;
+			if (glob(argv[i], 0, NULL, &found) != 0) {
+				cerr << "nothing matches " << argv[i] << endl;
+				continue;
+			}
+			inputSize += found.gl_pathc;
+			inputs = (char**)realloc(inputs, sizeof(char*)*inputSize);
+			for (size_t g = 0; g < found.gl_pathc; g++) { inputs[count++] = strdup(found.gl_pathv[g]); }
+			globfree(&found);
+		}
+		else {
+			inputs[count++] = argv[i];
+		}
+	}
+#ifdef PROFILE
+	atexit(profileReport);
+#endif
+	if (bench) {
+		return runBenchmark();
+	}
+	if (verify) {
+		return runVerify(inputs, count);
+	}
+	if (pipes > 0) { // headless batch mode, no GLUT at all
+		bool valid = (outCount == pipes && count > 0);
+		for (int p = 0; p < pipes && valid; p++) {
+			Pipeline pipe;
+			valid = compilePipeline(pipelines[p], pipe);
+			if (valid) { freePipeline(pipe); }
+		}
+		if (!valid) {
+			printUsage(argv[0]);
+			printMenu();
+			return 2;
+		}
+		return runBatch(pipelines, outs, pipes, inputs, count);
+	}
+	if (count != 1) {
+		printUsage(argv[0]);
+		return 2;
+	}
+	saveBuffer = imageLoader(inputs[0]); // load save buffer
+	if (saveBuffer.data == NULL) {
+		cerr << "could not load " << inputs[0] << endl;
+		return 1;
+	}
 	workBuffer = copyImage(saveBuffer); // create work buffer
 	printMenu(); // print CLI interface
 	// Glut stuff
 	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_RGB | GLUT_SINGLE);
-	glutInitWindowSize(workBuffer.width, workBuffer.height);
+	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE);
+	glutInitWindowSize(min(workBuffer.width, 1600), min(workBuffer.height, 1000));
 	glutCreateWindow("3P98 Assignment 1");
+	initDisplay();
+	startWorker();
 	glutKeyboardFunc(menu);
+	glutSpecialFunc(specialKey);
+	glutMouseFunc(mouseButton);
+	glutMotionFunc(mouseDrag);
+	glutReshapeFunc(reshapeWindow);
 	glutDisplayFunc(displayImage);
 	glutMainLoop();
 	return 0;